@@ -0,0 +1,149 @@
+#include <stdio.h>
+
+#include <Arduino.h>
+
+#include "simulator.h"
+
+HardwareSerial Serial;
+
+size_t Print::write(const uint8_t *buffer, size_t size) {
+  size_t written = 0;
+  while (size--) {
+    written += write(*buffer++);
+  }
+  return written;
+}
+
+size_t Print::print(const __FlashStringHelper *str) {
+  return write((const char *) str);
+}
+
+size_t Print::print(const char *str) {
+  return write(str);
+}
+
+size_t Print::print(char value) {
+  return write((uint8_t) value);
+}
+
+size_t Print::print(unsigned char value, int base) {
+  return printNumber(value, base);
+}
+
+size_t Print::print(int value, int base) {
+  return print((long) value, base);
+}
+
+size_t Print::print(unsigned int value, int base) {
+  return printNumber(value, base);
+}
+
+size_t Print::print(long value, int base) {
+  if (base == DEC && value < 0) {
+    return write('-') + printNumber(-(unsigned long) value, base);
+  }
+  return printNumber(value, base);
+}
+
+size_t Print::print(unsigned long value, int base) {
+  return printNumber(value, base);
+}
+
+size_t Print::print(double value, int digits) {
+  char buffer[48];
+  if (isnan(value)) {
+    return write("nan");
+  }
+  if (isinf(value)) {
+    return write("inf");
+  }
+  snprintf(buffer, sizeof(buffer), "%.*f", digits, value);
+  return write(buffer);
+}
+
+size_t Print::println() {
+  return write('\r') + write('\n');
+}
+
+size_t Print::printNumber(unsigned long value, uint8_t base) {
+  char buffer[8 * sizeof(long) + 1];
+  char *str = &buffer[sizeof(buffer) - 1];
+  *str = '\0';
+  if (base < 2) {
+    base = 10;
+  }
+  do {
+    char digit = value % base;
+    value /= base;
+    *--str = digit < 10 ? digit + '0' : digit + 'A' - 10;
+  } while (value);
+  return write(str);
+}
+
+void HardwareSerial::begin(unsigned long baud) {
+  Sim::beginSerial(baud);
+}
+
+int HardwareSerial::availableForWrite() {
+  return Sim::availableForWriteSerial();
+}
+
+int HardwareSerial::available() {
+  return Sim::availableSerial();
+}
+
+int HardwareSerial::read() {
+  return Sim::readSerial(false);
+}
+
+int HardwareSerial::peek() {
+  return Sim::readSerial(true);
+}
+
+size_t HardwareSerial::write(uint8_t value) {
+  Sim::writeSerial(value);
+  return 1;
+}
+
+uint32_t millis() {
+  return Sim::now() / 1000;
+}
+
+uint32_t micros() {
+  return Sim::now();
+}
+
+void delay(uint32_t ms) {
+  Sim::advance(ms * 1000ULL);
+}
+
+void delayMicroseconds(unsigned int us) {
+  Sim::advance(us);
+}
+
+static uint32_t randomState = 1;
+
+long random(long howBig) {
+  if (howBig == 0) {
+    return 0;
+  }
+  randomState = randomState * 1103515245 + 12345;
+  return (randomState >> 1) % howBig;
+}
+
+long random(long howSmall, long howBig) {
+  if (howSmall >= howBig) {
+    return howSmall;
+  }
+  return howSmall + random(howBig - howSmall);
+}
+
+void randomSeed(unsigned long seed) {
+  if (seed != 0) {
+    randomState = seed;
+  }
+}
+
+long map(long value, long fromLow, long fromHigh, long toLow, long toHigh) {
+  return (value - fromLow) * (toHigh - toLow) / (fromHigh - fromLow) + toLow;
+}
@@ -0,0 +1,308 @@
+#include <dirent.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#include <Arduino.h>
+#include <EEPROM.h>
+#include <SdFat.h>
+#include <SSD1306Ascii.h>
+#include <ClickEncoder.h>
+#include <util/twi.h>
+
+#include "simulator.h"
+#include "../src/constants.h"
+
+static const uint32_t EEPROM_WRITE_US = 3400;
+
+EEPROMClass EEPROM;
+static uint64_t eepromReadyTime = 0;
+
+bool eeprom_is_ready() {
+  return Sim::now() >= eepromReadyTime;
+}
+
+EEPROMClass::EEPROMClass() {
+  memset(data, 0xFF, sizeof(data));
+  memset(writeCount, 0, sizeof(writeCount));
+}
+
+uint8_t EEPROMClass::read(int address) const {
+  return address >= 0 && address < SIZE ? data[address] : 0xFF;
+}
+
+void EEPROMClass::write(int address, uint8_t value) {
+  if (address < 0 || address >= SIZE) {
+    return;
+  }
+  if (!eeprom_is_ready()) {
+    Sim::advance(eepromReadyTime - Sim::now());
+  }
+  data[address] = value;
+  ++writeCount[address];
+  eepromReadyTime = Sim::now() + EEPROM_WRITE_US;
+}
+
+void EEPROMClass::update(int address, uint8_t value) {
+  if (read(address) != value) {
+    write(address, value);
+  }
+}
+
+uint32_t EEPROMClass::getWriteCount(int address) const {
+  return address >= 0 && address < SIZE ? writeCount[address] : 0;
+}
+
+// Missing file is an erased EEPROM
+bool EEPROMClass::load(const char *path) {
+  FILE *file = fopen(path, "rb");
+  if (!file) {
+    return true;
+  }
+  bool success = fread(data, 1, sizeof(data), file) == sizeof(data);
+  fclose(file);
+  return success;
+}
+
+bool EEPROMClass::save(const char *path) const {
+  FILE *file = fopen(path, "wb");
+  if (!file) {
+    return false;
+  }
+  bool success = fwrite(data, 1, sizeof(data), file) == sizeof(data);
+  return fclose(file) == 0 && success;
+}
+
+
+class FatFile {
+public:
+  std::vector<std::string> names;
+};
+
+static FatFile rootDirectory;
+
+static std::string getPath(const char *name) {
+  return std::string(Sim::getSdDirectory()) + "/" + name;
+}
+
+bool SdFat::begin(uint8_t csPin, uint32_t speed) {
+  rootDirectory.names.clear();
+  DIR *directory = Sim::getSdDirectory() ? opendir(Sim::getSdDirectory()) : NULL;
+  if (!directory) {
+    return false;
+  }
+  for (struct dirent *entry = readdir(directory); entry; entry = readdir(directory)) {
+    if (entry->d_name[0] != '.' && strlen(entry->d_name) <= 12) {
+      rootDirectory.names.push_back(entry->d_name);
+    }
+  }
+  closedir(directory);
+  return true;
+}
+
+FatFile *SdFat::vwd() {
+  return &rootDirectory;
+}
+
+bool SdFat::exists(const char *path) {
+  struct stat info;
+  return stat(getPath(path).c_str(), &info) == 0;
+}
+
+bool SdFat::remove(const char *path) {
+  return unlink(getPath(path).c_str()) == 0;
+}
+
+bool SdFile::open(const char *path, uint8_t flags) {
+  if (file) {
+    return false;
+  }
+  std::string fullPath = getPath(path);
+  if (flags & O_TRUNC || (flags & O_CREAT && access(fullPath.c_str(), F_OK) != 0)) {
+    file = fopen(fullPath.c_str(), "w+b");
+  } else {
+    file = fopen(fullPath.c_str(), flags & O_WRITE ? "r+b" : "rb");
+  }
+  if (!file) {
+    return false;
+  }
+  snprintf(name, sizeof(name), "%s", path);
+  return true;
+}
+
+bool SdFile::openNext(FatFile *directory, uint8_t flags) {
+  while (directoryIndex < directory->names.size()) {
+    if (open(directory->names[directoryIndex++].c_str(), flags)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Preallocated space reads as zeros like an erased card
+bool SdFile::createContiguous(const char *path, uint32_t size) {
+  return open(path, O_CREAT | O_RDWR | O_TRUNC) && ftruncate(fileno(file), size) == 0;
+}
+
+bool SdFile::contiguousRange(uint32_t *firstBlock, uint32_t *lastBlock) {
+  *firstBlock = 0;
+  *lastBlock = fileSize() / 512;
+  return isOpen();
+}
+
+bool SdFile::close() {
+  if (!file) {
+    return false;
+  }
+  bool success = fclose(file) == 0;
+  file = NULL;
+  return success;
+}
+
+bool SdFile::getName(char *buffer, size_t size) {
+  if (!file || strlen(name) >= size) {
+    return false;
+  }
+  strcpy(buffer, name);
+  return true;
+}
+
+int SdFile::read(void *buffer, size_t size) {
+  return file ? fread(buffer, 1, size, file) : -1;
+}
+
+int SdFile::read() {
+  uint8_t value;
+  return read(&value, 1) == 1 ? value : -1;
+}
+
+int SdFile::write(const void *buffer, size_t size) {
+  return file ? fwrite(buffer, 1, size, file) : -1;
+}
+
+size_t SdFile::write(uint8_t value) {
+  return write(&value, 1) == 1 ? 1 : 0;
+}
+
+size_t SdFile::write(const uint8_t *buffer, size_t size) {
+  int written = write((const void *) buffer, size);
+  return written < 0 ? 0 : written;
+}
+
+bool SdFile::seekSet(uint32_t position) {
+  return file && fseek(file, position, SEEK_SET) == 0;
+}
+
+uint32_t SdFile::curPosition() {
+  return file ? ftell(file) : 0;
+}
+
+uint32_t SdFile::fileSize() {
+  struct stat info;
+  if (!file || fflush(file) != 0 || fstat(fileno(file), &info) != 0) {
+    return 0;
+  }
+  return info.st_size;
+}
+
+bool SdFile::truncate(uint32_t length) {
+  return file && fflush(file) == 0 && ftruncate(fileno(file), length) == 0 && seekSet(length);
+}
+
+bool SdFile::sync() {
+  return file && fflush(file) == 0;
+}
+
+
+const DevType Adafruit128x64 = {128, 64};
+const uint8_t font5x7[] = {0, 0, 5, 7, 32, 96};
+
+SSD1306Ascii *simulatedDisplay = NULL;
+
+SSD1306Ascii::SSD1306Ascii() : column(0), currentRow(0), busBytes(0) {
+  memset(text, ' ', sizeof(text));
+  for (uint8_t row = 0; row < ROWS; ++row) {
+    text[row][COLUMNS] = '\0';
+  }
+}
+
+void SSD1306Ascii::clear() {
+  for (uint8_t row = 0; row < ROWS; ++row) {
+    memset(text[row], ' ', COLUMNS);
+  }
+  send(128 * ROWS);
+  setCursor(0, 0);
+}
+
+void SSD1306Ascii::clearToEOL() {
+  for (uint8_t i = column / 6; i < COLUMNS; ++i) {
+    text[currentRow][i] = ' ';
+  }
+  send(128 - min(column, (uint8_t) 128));
+}
+
+// Column and page address commands
+void SSD1306Ascii::setCursor(uint8_t newColumn, uint8_t row) {
+  column = newColumn;
+  currentRow = row % ROWS;
+  send(3);
+}
+
+void SSD1306Ascii::setCol(uint8_t newColumn) {
+  setCursor(newColumn, currentRow);
+}
+
+void SSD1306Ascii::setRow(uint8_t row) {
+  setCursor(column, row);
+}
+
+size_t SSD1306Ascii::write(uint8_t value) {
+  if (value == '\r') {
+    return 1;
+  }
+  if (value == '\n') {
+    setCursor(0, currentRow + 1);
+    return 1;
+  }
+  if (column / 6 >= COLUMNS) {
+    return 0; // real driver stops at the right edge too
+  }
+  text[currentRow][column / 6] = value;
+  column += 6;
+  send(6);
+  return 1;
+}
+
+static void waitForDisplayTwi() {
+  while (!(TWCR & _BV(TWINT))) {}
+}
+
+static void sendDisplayTwi(uint8_t data) {
+  TWDR = data;
+  TWCR = _BV(TWINT) | _BV(TWEN);
+  waitForDisplayTwi();
+}
+
+// Start, address, control byte, data and stop, no checks like the driver
+void SSD1306Ascii::send(uint16_t bytes) {
+  TWCR = _BV(TWINT) | _BV(TWSTA) | _BV(TWEN);
+  waitForDisplayTwi();
+  sendDisplayTwi(DISPLAY_I2C_ADDRESS << 1 | TW_WRITE);
+  sendDisplayTwi(0x40); // data follows
+  for (uint16_t i = 0; i < bytes; ++i) {
+    sendDisplayTwi(0);
+  }
+  TWCR = _BV(TWINT) | _BV(TWSTO) | _BV(TWEN);
+  busBytes += bytes;
+}
+
+
+int16_t ClickEncoder::getValue() {
+  return Sim::takeEncoderSteps();
+}
+
+ClickEncoder::Button ClickEncoder::getButton() {
+  return (Button) Sim::takeEncoderButton();
+}
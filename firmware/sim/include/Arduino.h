@@ -0,0 +1,136 @@
+#pragma once
+
+// Minimal Arduino core for the native simulation build. Only what firmware
+// uses is provided, time is simulated, see ../simulator.h.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "avr/io.h"
+#include "avr/pgmspace.h"
+#include "avr/interrupt.h"
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+
+#define A0 14
+#define A1 15
+#define A2 16
+#define A3 17
+#define A4 18
+#define A5 19
+#define A6 20
+#define A7 21
+
+#define DEC 10
+#define HEX 16
+
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+#define bit(b) (1UL << (b))
+
+template<typename T, typename U>
+inline auto min(T a, U b) -> decltype(a + b) { return a < b ? a : b; }
+template<typename T, typename U>
+inline auto max(T a, U b) -> decltype(a + b) { return a > b ? a : b; }
+
+class __FlashStringHelper;
+#define F(s) (reinterpret_cast<const __FlashStringHelper *>(PSTR(s)))
+
+class Print {
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t value) = 0;
+  virtual size_t write(const uint8_t *buffer, size_t size);
+  size_t write(const char *str) {
+    return str ? write((const uint8_t *) str, strlen(str)) : 0;
+  }
+
+  size_t print(const __FlashStringHelper *str);
+  size_t print(const char *str);
+  size_t print(char value);
+  size_t print(unsigned char value, int base = DEC);
+  size_t print(int value, int base = DEC);
+  size_t print(unsigned int value, int base = DEC);
+  size_t print(long value, int base = DEC);
+  size_t print(unsigned long value, int base = DEC);
+  size_t print(double value, int digits = 2);
+
+  size_t println();
+  template<typename T>
+  size_t println(T value) {
+    size_t size = print(value);
+    return size + println();
+  }
+  template<typename T>
+  size_t println(T value, int format) {
+    size_t size = print(value, format);
+    return size + println();
+  }
+
+private:
+  size_t printNumber(unsigned long value, uint8_t base);
+};
+
+class Stream : public Print {
+public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+};
+
+class HardwareSerial : public Stream {
+public:
+  void begin(unsigned long baud);
+  void end() {}
+  int available() override;
+  int read() override;
+  int peek() override;
+  int availableForWrite();
+  size_t write(uint8_t value) override;
+  using Print::write;
+  void flush() {}
+  operator bool() { return true; }
+};
+
+extern HardwareSerial Serial;
+
+// Keeps the pointer only. Trivial destructor keeps goto over a String
+// legal, as firmware does in SdCardLogger::setup().
+class String {
+  const char *buffer;
+public:
+  String(const char *str) : buffer(str ? str : "") {}
+  const char *c_str() const { return buffer; }
+  unsigned int length() const { return strlen(buffer); }
+};
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+int analogRead(uint8_t pin);
+
+// Arduino long is 32 bit, so is time
+uint32_t millis();
+uint32_t micros();
+void delay(uint32_t ms);
+void delayMicroseconds(unsigned int us);
+
+long random(long howBig);
+long random(long howSmall, long howBig);
+void randomSeed(unsigned long seed);
+long map(long value, long fromLow, long fromHigh, long toLow, long toHigh);
+
+inline void interrupts() {}
+inline void noInterrupts() {}
+
+void setup();
+void loop();
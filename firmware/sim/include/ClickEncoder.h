@@ -0,0 +1,22 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Encoder without hands, simulator may queue rotation and button events
+class ClickEncoder {
+public:
+  enum Button {
+    Open = 0,
+    Closed,
+    Pressed,
+    Held,
+    Released,
+    Clicked,
+    DoubleClicked
+  };
+
+  ClickEncoder(uint8_t pinA, uint8_t pinB, uint8_t pinButton = -1, uint8_t stepsPerNotch = 1, bool active = LOW) {}
+  void service() {}
+  int16_t getValue();
+  Button getButton();
+};
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <avr/eeprom.h>
+
+// 1KB EEPROM of ATmega328P, erased state is 0xFF. Byte write waits for the
+// previous one like eeprom_write_byte() and then takes 3.4ms in background.
+// Writes are counted per cell so wear can be checked after a run.
+class EEPROMClass {
+public:
+  static const uint16_t SIZE = 1024;
+
+  EEPROMClass();
+  uint8_t read(int address) const;
+  void write(int address, uint8_t value);
+  void update(int address, uint8_t value);
+  uint16_t length() const { return SIZE; }
+  uint32_t getWriteCount(int address) const;
+  bool load(const char *path);
+  bool save(const char *path) const;
+
+  template<typename T>
+  T &get(int address, T &value) const {
+    uint8_t *bytes = (uint8_t *) &value;
+    for (size_t i = 0; i < sizeof(T); ++i) {
+      bytes[i] = read(address + i);
+    }
+    return value;
+  }
+
+  // Like avr EEPROM library, unchanged bytes are not written
+  template<typename T>
+  const T &put(int address, const T &value) {
+    const uint8_t *bytes = (const uint8_t *) &value;
+    for (size_t i = 0; i < sizeof(T); ++i) {
+      update(address + i, bytes[i]);
+    }
+    return value;
+  }
+
+private:
+  uint8_t data[SIZE];
+  uint32_t writeCount[SIZE];
+};
+
+extern EEPROMClass EEPROM;
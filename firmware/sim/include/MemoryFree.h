@@ -0,0 +1,6 @@
+#pragma once
+
+// Host heap says nothing about AVR RAM
+inline int freeMemory() {
+  return 0;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <Arduino.h>
+
+struct DevType {
+  uint8_t width;
+  uint8_t height;
+};
+
+extern const DevType Adafruit128x64;
+extern const uint8_t font5x7[];
+
+// Text only display, keeps characters instead of pixels so simulator can
+// print the screen. Sends bytes that would go to display RAM over the TWI
+// model, polling it like the real driver, and counts them.
+class SSD1306Ascii : public Print {
+public:
+  static const uint8_t ROWS = 8;
+  static const uint8_t COLUMNS = 21;
+
+  SSD1306Ascii();
+  void clear();
+  void clearToEOL();
+  void setCursor(uint8_t column, uint8_t row);
+  void setCol(uint8_t column);
+  void setRow(uint8_t row);
+  uint8_t col() const { return column; }
+  uint8_t row() const { return currentRow; }
+  void setFont(const uint8_t *font) {}
+  void setContrast(uint8_t value) {}
+  uint8_t fontWidth() const { return 5; }
+  uint8_t fontHeight() const { return 7; }
+  uint8_t letterSpacing() const { return 1; }
+  uint8_t displayWidth() const { return 128; }
+  uint8_t displayRows() const { return ROWS; }
+  size_t write(uint8_t value) override;
+  using Print::write;
+
+  const char *getRow(uint8_t row) const { return text[row]; }
+  uint32_t getBusBytes() const { return busBytes; }
+
+private:
+  void send(uint16_t bytes); // one bus transaction
+
+  char text[ROWS][COLUMNS + 1];
+  uint8_t column; // pixels
+  uint8_t currentRow;
+  uint32_t busBytes;
+};
+
+extern SSD1306Ascii *simulatedDisplay;
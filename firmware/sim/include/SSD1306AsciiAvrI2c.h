@@ -0,0 +1,13 @@
+#pragma once
+
+#include "SSD1306Ascii.h"
+
+class SSD1306AsciiAvrI2c : public SSD1306Ascii {
+public:
+  void begin(const DevType *device, uint8_t address) {
+    simulatedDisplay = this;
+    TWSR = 0; // 400kHz like the real driver
+    TWBR = (F_CPU / 400000 - 16) / 2;
+    clear();
+  }
+};
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stdio.h>
+#include <Arduino.h>
+
+// SdFat subset backed by a host directory, see Sim::setSdDirectory()
+
+#define O_READ 0x01
+#define O_WRITE 0x02
+#define O_RDWR (O_READ | O_WRITE)
+#define O_APPEND 0x04
+#define O_CREAT 0x10
+#define O_TRUNC 0x20
+#define O_EXCL 0x40
+#define SD_SCK_MHZ(maxMhz) (1000000UL * (maxMhz))
+
+class FatFile;
+
+class SdSpiCard {
+public:
+  // Preallocated files are already zero filled
+  bool erase(uint32_t firstBlock, uint32_t lastBlock) { return true; }
+};
+
+class SdFile : public Print {
+public:
+  SdFile() : file(NULL), directoryIndex(0) { name[0] = '\0'; }
+  ~SdFile() { close(); }
+
+  bool open(const char *path, uint8_t flags);
+  bool openNext(FatFile *directory, uint8_t flags);
+  bool createContiguous(const char *path, uint32_t size);
+  bool contiguousRange(uint32_t *firstBlock, uint32_t *lastBlock);
+  bool close();
+  bool isOpen() const { return file != NULL; }
+  bool getName(char *buffer, size_t size);
+
+  int read(void *buffer, size_t size);
+  int read();
+  int write(const void *buffer, size_t size);
+  size_t write(uint8_t value) override;
+  size_t write(const uint8_t *buffer, size_t size) override;
+  using Print::write;
+
+  bool seekSet(uint32_t position);
+  uint32_t curPosition();
+  uint32_t fileSize();
+  bool truncate(uint32_t length);
+  bool sync();
+
+private:
+  FILE *file;
+  char name[13];
+  size_t directoryIndex;
+};
+
+class SdFat {
+public:
+  bool begin(uint8_t csPin, uint32_t speed);
+  FatFile *vwd();
+  SdSpiCard *card() { return &spiCard; }
+  bool exists(const char *path);
+  bool remove(const char *path);
+
+private:
+  SdSpiCard spiCard;
+};
@@ -0,0 +1,4 @@
+#pragma once
+
+// False while the last byte write is in progress
+bool eeprom_is_ready();
@@ -0,0 +1,13 @@
+#pragma once
+
+// Vectors are plain functions, simulator calls them between loop() passes
+// and where firmware waits for hardware, see simulator.h.
+#define ISR(vector, ...) extern "C" void vector(void)
+
+#define TIMER1_OVF_vect timer1OverflowVector
+#define USART_UDRE_vect usartDataEmptyVector
+#define ADC_vect adcVector
+#define TWI_vect twiVector
+
+#define sei()
+#define cli()
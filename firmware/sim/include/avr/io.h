@@ -0,0 +1,104 @@
+#pragma once
+
+// Registers firmware touches directly, simulator reads and updates them.
+// Bit numbers match ATmega328P.
+
+#include <stdint.h>
+
+#define _BV(bit) (1 << (bit))
+
+extern volatile uint8_t SREG;
+
+// Timer1, Fast PWM load control and 1kHz tick
+extern volatile uint8_t TCCR1A;
+extern volatile uint8_t TCCR1B;
+extern volatile uint8_t TIMSK1;
+extern volatile uint16_t OCR1B;
+extern volatile uint16_t ICR1;
+#define WGM10 0
+#define WGM11 1
+#define COM1B0 4
+#define COM1B1 5
+#define CS10 0
+#define CS11 1
+#define CS12 2
+#define WGM12 3
+#define WGM13 4
+#define TOIE1 0
+
+// Timer2, fan pwm
+extern volatile uint8_t TCCR2A;
+extern volatile uint8_t TCCR2B;
+extern volatile uint8_t OCR2A;
+extern volatile uint8_t OCR2B;
+#define WGM20 0
+#define WGM21 1
+#define COM2B1 5
+#define CS20 0
+#define CS21 1
+#define CS22 2
+#define WGM22 3
+
+// ADC
+extern volatile uint8_t ADMUX;
+extern volatile uint8_t ADCSRA;
+extern volatile uint8_t ADCSRB;
+extern volatile uint16_t ADC;
+#define MUX0 0
+#define REFS0 6
+#define REFS1 7
+#define ADPS0 0
+#define ADPS1 1
+#define ADPS2 2
+#define ADIE 3
+#define ADIF 4
+#define ADATE 5
+#define ADSC 6
+#define ADEN 7
+#define ADTS0 0
+#define ADTS1 1
+#define ADTS2 2
+
+// USART0
+extern volatile uint8_t UCSR0A;
+extern volatile uint8_t UCSR0B;
+extern volatile uint8_t UCSR0C;
+extern volatile uint16_t UBRR0;
+extern volatile uint8_t UDR0;
+#define U2X0 1
+#define UDRE0 5
+#define UCSZ00 1
+#define UCSZ01 2
+#define TXEN0 3
+#define RXEN0 4
+#define UDRIE0 5
+#define RXCIE0 7
+
+// TWI. TWCR writes start bus conditions and transfers in the simulator,
+// reads from loop() let the clock run while a transfer is in flight, as
+// polling it would
+class TwiControlRegister {
+public:
+  TwiControlRegister &operator=(uint8_t value);
+  operator uint8_t() const;
+};
+
+extern TwiControlRegister TWCR;
+extern volatile uint8_t TWDR;
+extern volatile uint8_t TWSR;
+extern volatile uint8_t TWBR;
+#define TWIE 0
+#define TWEN 2
+#define TWWC 3
+#define TWSTO 4
+#define TWSTA 5
+#define TWEA 6
+#define TWINT 7
+#define TWPS0 0
+#define TWPS1 1
+
+#define E2END 0x3FF
+
+#ifndef F_CPU
+#define F_CPU 16000000UL
+#endif
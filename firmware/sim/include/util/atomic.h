@@ -0,0 +1,12 @@
+#pragma once
+
+namespace Sim {
+  void endAtomicBlock();
+};
+
+// Interrupts run between loop() passes and when an atomic block in loop()
+// ends. The end takes 1 us, so loops waiting for an interrupt get there.
+#define ATOMIC_RESTORESTATE
+#define ATOMIC_FORCEON
+#define ATOMIC_BLOCK(type) for (bool atomicBlockOnce = true; atomicBlockOnce; \
+    atomicBlockOnce = false, Sim::endAtomicBlock())
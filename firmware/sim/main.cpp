@@ -0,0 +1,601 @@
+// Runs the real setup()/loop() against simulated load hardware and a
+// battery or power supply, much faster than real time. Commands go to the
+// firmware over simulated serial, see src/remote_control.h.
+//
+// Build: pio run -e native
+// Usage: .pio/build/native/program [options] [command ...]
+//   --hours H             simulated time limit, default 24
+//   --battery C,MAH,MOHM  Li-ion cells in series, capacity, pack resistance,
+//                         default 1,2500,60
+//   --soc PERCENT         battery charge at start, default 100
+//   --psu MV,MOHM         power supply instead of battery
+//   --ambient C           ambient temperature, default 25
+//   --sd DIR              SD card contents, no card by default
+//   --eeprom FILE         EEPROM image, loaded if exists and saved at the end,
+//                         erased EEPROM by default. Ending the run with
+//                         --hours cuts power, possibly in the middle of write.
+//   --telemetry FILE      UART bytes when firmware has TELEMETRY_ENABLED
+//   --script FILE         "SECONDS COMMAND" lines, seconds after setup()
+//   --fault SECONDS,MA    from SECONDS after setup() load draws MA more while
+//                         switched on, as with a shorted mosfet
+//   --ramp SECONDS,MV,MS  from SECONDS after setup() power supply voltage
+//                         moves to MV over MS milliseconds
+//   --step SECONDS,MA     sends CURR MA at SECONDS after setup() and prints
+//                         rise time, overshoot and settling time of the load
+//                         current, from the first pwm change
+//   --loop-us US          time one loop() pass takes, 0 jumps to the next
+//                         interrupt, default 0
+//   --seed N              sensor noise seed, 0 disables noise, default 1
+//   --keep-running        do not stop when load switches itself off
+//   --quiet               drop firmware serial output
+//   --screen              print display contents at the end
+// Commands given as arguments are sent 2 s after setup() in one go.
+// Example: program --sd /tmp/sd "CURR 1000" "VOLT:STOP 3000" "OUTP ON"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+#include <vector>
+
+#include <Arduino.h>
+#include <EEPROM.h>
+#include <SSD1306Ascii.h>
+
+#include "simulator.h"
+#include "../src/constants.h"
+#include "../src/system_state.h"
+#include "../src/managers.h"
+#include "../src/task_scheduler.h"
+#include "../src/display_frame.h"
+
+namespace {
+  // Commands from the command line wait for the first averages, otherwise
+  // zero average voltage trips the stop voltage right away
+  const uint64_t COMMAND_DELAY_US = 2 * REFRESH_INTERVAL_MS * 1000ULL;
+
+  struct ScriptLine {
+    uint64_t time; // us
+    std::string command;
+  };
+
+  struct Options {
+    Sim::ModelConfig model;
+    double hours;
+    const char *sdDirectory;
+    const char *eepromFile;
+    const char *telemetryFile;
+    const char *scriptFile;
+    double faultTime; // s after setup(), negative for none
+    double faultAmperage; // mA
+    double rampTime; // s after setup(), negative for none
+    double rampVoltage; // mV
+    double rampDuration; // ms
+    double stepTime; // s after setup(), negative for none
+    uint32_t stepAmperage; // mA
+    uint32_t loopCost;
+    bool isKeepRunning;
+    bool isQuiet;
+    bool isScreenPrinted;
+    std::vector<ScriptLine> script;
+  };
+
+  void printUsage(const char *program) {
+    fprintf(stderr, "Usage: %s [--hours H] [--battery C,MAH,MOHM] [--soc PERCENT] [--psu MV,MOHM]\n"
+        "  [--ambient C] [--sd DIR] [--eeprom FILE] [--telemetry FILE] [--script FILE] [--fault SECONDS,MA]\n"
+        "  [--ramp SECONDS,MV,MS] [--step SECONDS,MA] [--loop-us US] [--seed N] [--keep-running] [--quiet]\n"
+        "  [--screen] [command ...]\n", program);
+  }
+
+  bool readScript(const char *path, std::vector<ScriptLine> &script) {
+    FILE *file = fopen(path, "r");
+    if (!file) {
+      return false;
+    }
+    char line[256];
+    while (fgets(line, sizeof(line), file)) {
+      char *end;
+      double seconds = strtod(line, &end);
+      if (end == line) {
+        continue; // comment or empty line
+      }
+      while (*end == ' ' || *end == '\t') {
+        ++end;
+      }
+      end[strcspn(end, "\r\n")] = '\0';
+      script.push_back({(uint64_t) (seconds * 1e6), end});
+    }
+    fclose(file);
+    return true;
+  }
+
+  bool parseOptions(int argc, char **argv, Options &options) {
+    options.model.source = {true, 1, 2500, 1, 60, 0};
+    options.model.ambientTemperature = 25;
+    options.model.amperageGain = 0.98;
+    options.model.amperageOffset = -10;
+    options.model.noise = 2;
+    options.model.seed = 1;
+    options.hours = 24;
+    options.sdDirectory = NULL;
+    options.eepromFile = NULL;
+    options.telemetryFile = NULL;
+    options.scriptFile = NULL;
+    options.faultTime = -1;
+    options.faultAmperage = 0;
+    options.rampTime = -1;
+    options.rampVoltage = 0;
+    options.rampDuration = 0;
+    options.stepTime = -1;
+    options.stepAmperage = 0;
+    options.loopCost = 0;
+    options.isKeepRunning = false;
+    options.isQuiet = false;
+    options.isScreenPrinted = false;
+
+    Sim::SourceConfig &source = options.model.source;
+    for (int i = 1; i < argc; ++i) {
+      const char *arg = argv[i];
+      bool hasValue = i + 1 < argc;
+      if (!strcmp(arg, "--hours") && hasValue) {
+        options.hours = atof(argv[++i]);
+      } else if (!strcmp(arg, "--battery") && hasValue) {
+        unsigned cells;
+        if (sscanf(argv[++i], "%u,%lf,%lf", &cells, &source.capacity, &source.resistance) != 3 || cells == 0) {
+          return false;
+        }
+        source.isBattery = true;
+        source.cells = cells;
+      } else if (!strcmp(arg, "--soc") && hasValue) {
+        source.stateOfCharge = atof(argv[++i]) / 100;
+      } else if (!strcmp(arg, "--psu") && hasValue) {
+        if (sscanf(argv[++i], "%lf,%lf", &source.voltage, &source.resistance) != 2) {
+          return false;
+        }
+        source.isBattery = false;
+      } else if (!strcmp(arg, "--ambient") && hasValue) {
+        options.model.ambientTemperature = atof(argv[++i]);
+      } else if (!strcmp(arg, "--sd") && hasValue) {
+        options.sdDirectory = argv[++i];
+      } else if (!strcmp(arg, "--eeprom") && hasValue) {
+        options.eepromFile = argv[++i];
+      } else if (!strcmp(arg, "--telemetry") && hasValue) {
+        options.telemetryFile = argv[++i];
+      } else if (!strcmp(arg, "--script") && hasValue) {
+        options.scriptFile = argv[++i];
+      } else if (!strcmp(arg, "--fault") && hasValue) {
+        if (sscanf(argv[++i], "%lf,%lf", &options.faultTime, &options.faultAmperage) != 2
+            || options.faultTime < 0) {
+          return false;
+        }
+      } else if (!strcmp(arg, "--ramp") && hasValue) {
+        if (sscanf(argv[++i], "%lf,%lf,%lf", &options.rampTime, &options.rampVoltage, &options.rampDuration) != 3
+            || options.rampTime < 0 || options.rampDuration < 0) {
+          return false;
+        }
+      } else if (!strcmp(arg, "--step") && hasValue) {
+        if (sscanf(argv[++i], "%lf,%u", &options.stepTime, &options.stepAmperage) != 2
+            || options.stepTime < 0) {
+          return false;
+        }
+      } else if (!strcmp(arg, "--loop-us") && hasValue) {
+        options.loopCost = atol(argv[++i]);
+      } else if (!strcmp(arg, "--seed") && hasValue) {
+        options.model.seed = strtoul(argv[++i], NULL, 0);
+        options.model.noise = options.model.seed ? options.model.noise : 0;
+      } else if (!strcmp(arg, "--keep-running")) {
+        options.isKeepRunning = true;
+      } else if (!strcmp(arg, "--quiet")) {
+        options.isQuiet = true;
+      } else if (!strcmp(arg, "--screen")) {
+        options.isScreenPrinted = true;
+      } else if (arg[0] == '-' && arg[1] == '-') {
+        return false;
+      } else {
+        options.script.push_back({COMMAND_DELAY_US, arg});
+      }
+    }
+    if (options.rampTime >= 0 && source.isBattery) {
+      fprintf(stderr, "--ramp needs --psu\n");
+      return false;
+    }
+    if (options.scriptFile && !readScript(options.scriptFile, options.script)) {
+      fprintf(stderr, "Can not read %s\n", options.scriptFile);
+      return false;
+    }
+    return true;
+  }
+
+  // Task run counters wrap, so they are summed after every loop() pass.
+  // SYST:TASK? resets them, a task never runs that often in one pass.
+  const uint16_t MAX_RUNS_PER_PASS = 1000;
+  std::vector<uint64_t> taskRuns;
+  std::vector<uint16_t> lastTaskRuns;
+
+  void countTaskRuns() {
+    uint8_t count = TaskScheduler::getTaskCount();
+    taskRuns.resize(count);
+    lastTaskRuns.resize(count);
+    for (uint8_t i = 0; i < count; ++i) {
+      uint16_t runs = TaskScheduler::getStats(i).runs;
+      uint16_t newRuns = runs - lastTaskRuns[i];
+      taskRuns[i] += newRuns > MAX_RUNS_PER_PASS ? runs : newRuns;
+      lastTaskRuns[i] = runs;
+    }
+  }
+
+  // Load current after a setpoint step, as the model sees it
+  const uint64_t STEP_WINDOW_US = 2000000;
+  // Wide band is mostly feed-forward, narrow one shows what PI removes
+  const double STEP_SETTLE_BANDS[] = {0.02, 0.005}; // of step size
+
+  struct StepPoint {
+    uint64_t time; // us
+    double amperage; // mA
+    uint16_t dutyCycle;
+  };
+
+  struct StepResponse {
+    uint64_t start; // us, command sent, 0 before the step
+    std::vector<StepPoint> trace;
+  } step = {0, {}};
+
+  // Transient phase lengths between pwm edges, in the order low and high.
+  // Edges are written from the timer interrupt, so they should be exact.
+  struct TransientEdges {
+    uint8_t sinceStart; // first phase starts wherever start() happened
+    bool isHigh;
+    uint64_t lastTime; // us
+    uint32_t count;
+    uint32_t minLength[2]; // us
+    uint32_t maxLength[2];
+  } transientEdges = {0, false, 0, 0, {UINT32_MAX, UINT32_MAX}, {0, 0}};
+
+  // Model voltage after transient edges, how long it really takes to stay
+  // within TRANSIENT_SETTLE_TOLERANCE_MV of where the phase ends. Firmware
+  // sees it through INA219 conversions, TRAN:RESP? should agree within its
+  // uncertainty.
+  struct TransientPoint {
+    uint64_t time; // us
+    double voltage; // mV
+  };
+
+  struct TransientRecovery {
+    std::vector<TransientPoint> trace; // since the last edge
+    uint32_t edges[2]; // falling and rising
+    double min[2]; // us
+    double max[2];
+  } transientRecovery = {{}, {0, 0}, {1e9, 1e9}, {0, 0}};
+
+  void recordTransientRecovery(bool isRisingEdge) {
+    const std::vector<TransientPoint> &trace = transientRecovery.trace;
+    if (trace.size() < 2) {
+      return;
+    }
+    double settled = trace.back().voltage;
+    size_t last = 0; // last point out of tolerance
+    for (size_t i = 0; i < trace.size(); ++i) {
+      if (fabs(trace[i].voltage - settled) > TRANSIENT_SETTLE_TOLERANCE_MV) {
+        last = i;
+      }
+    }
+    double recovery = 0;
+    if (last + 1 < trace.size()) {
+      // Crossing into tolerance between the two points
+      const TransientPoint &a = trace[last];
+      const TransientPoint &b = trace[last + 1];
+      double from = fabs(a.voltage - settled);
+      double to = fabs(b.voltage - settled);
+      double fraction = from > to ? (from - TRANSIENT_SETTLE_TOLERANCE_MV) / (from - to) : 0;
+      recovery = a.time - trace.front().time + fraction * (b.time - a.time);
+    }
+    TransientRecovery &result = transientRecovery;
+    ++result.edges[isRisingEdge];
+    result.min[isRisingEdge] = min(result.min[isRisingEdge], recovery);
+    result.max[isRisingEdge] = max(result.max[isRisingEdge], recovery);
+  }
+
+  void recordTransientVoltage() {
+    if (TransientLoad::isRunning() && !transientRecovery.trace.empty()) {
+      transientRecovery.trace.push_back({Sim::now(), Sim::getModelState().voltage});
+    }
+  }
+
+  void recordTransientEdge(uint64_t time, uint16_t from, uint16_t to) {
+    TransientEdges &edges = transientEdges;
+    if (edges.sinceStart >= 1) {
+      recordTransientRecovery(edges.isHigh);
+    }
+    transientRecovery.trace.clear();
+    if (!TransientLoad::isRunning()) {
+      edges.sinceStart = 0;
+      return;
+    }
+    // Model is updated up to the edge, new level starts now
+    transientRecovery.trace.push_back({time, Sim::getModelState().voltage});
+    if (edges.sinceStart >= 2) {
+      uint32_t length = time - edges.lastTime;
+      edges.minLength[edges.isHigh] = min(edges.minLength[edges.isHigh], length);
+      edges.maxLength[edges.isHigh] = max(edges.maxLength[edges.isHigh], length);
+      ++edges.count;
+    } else {
+      ++edges.sinceStart;
+    }
+    edges.isHigh = to > from;
+    edges.lastTime = time;
+  }
+
+  void recordStep(const Options &options, uint64_t sinceSetup) {
+    if (options.stepTime < 0) {
+      return;
+    }
+    if (step.start == 0) {
+      if (sinceSetup < options.stepTime * 1e6) {
+        return;
+      }
+      char command[32];
+      snprintf(command, sizeof(command), "CURR %u", options.stepAmperage);
+      Sim::sendSerialInput(command);
+      step.start = Sim::now();
+    }
+    if (Sim::now() - step.start <= STEP_WINDOW_US) {
+      step.trace.push_back({Sim::now(), Sim::getModelState().amperage, Sim::getLatchedDutyCycle()});
+    }
+  }
+
+  // Times are from the first pwm change, so command handling is not counted
+  // as controller response
+  void printStepResponse(uint32_t target) {
+    if (step.trace.size() < 2) {
+      return;
+    }
+    // Regulation moves pwm a little all the time, step starts when pwm
+    // passes half way to where it ends
+    const std::vector<StepPoint> &trace = step.trace;
+    double halfDutyCycle = (trace.front().dutyCycle + trace.back().dutyCycle) / 2.0;
+    bool isUp = trace.back().dutyCycle > trace.front().dutyCycle;
+    size_t first = 1;
+    while (first < trace.size() && (isUp ? trace[first].dutyCycle < halfDutyCycle : trace[first].dutyCycle > halfDutyCycle)) {
+      ++first;
+    }
+    if (first == trace.size() || trace.front().dutyCycle == trace.back().dutyCycle) {
+      fprintf(stderr, "step to %u mA: pwm did not change\n", target);
+      return;
+    }
+    uint64_t pwmTime = trace[first].time;
+    double from = trace[first - 1].amperage;
+    double final = 0;
+    size_t tailStart = trace.size() * 3 / 4;
+    for (size_t i = tailStart; i < trace.size(); ++i) {
+      final += trace[i].amperage;
+    }
+    final /= trace.size() - tailStart;
+    double size = final - from;
+    if (fabs(size) < 1) {
+      fprintf(stderr, "step to %u mA: current did not move\n", target);
+      return;
+    }
+    double rise10 = -1;
+    double rise90 = -1;
+    double peak = 0; // furthest beyond final value in step direction
+    double settled[2] = {0, 0};
+    for (size_t i = first; i < trace.size(); ++i) {
+      double progress = (trace[i].amperage - from) / size;
+      double ms = (trace[i].time - pwmTime) / 1000.0;
+      if (rise10 < 0 && progress >= 0.1) {
+        rise10 = ms;
+      }
+      if (rise90 < 0 && progress >= 0.9) {
+        rise90 = ms;
+      }
+      peak = max(peak, progress - 1);
+      for (uint8_t band = 0; band < 2; ++band) {
+        if (fabs(progress - 1) > STEP_SETTLE_BANDS[band]) {
+          settled[band] = ((i + 1 < trace.size() ? trace[i + 1].time : trace[i].time) - pwmTime) / 1000.0;
+        }
+      }
+    }
+    fprintf(stderr, "step %.0f -> %u mA: command to pwm %.1f ms, rise 10-90%% %.1f ms, overshoot %.1f%%,"
+        " settling %.1f%% %.1f ms %.1f%% %.1f ms, final %.0f mA\n",
+        from, target, (pwmTime - step.start) / 1000.0, rise90 >= 0 && rise10 >= 0 ? rise90 - rise10 : -1,
+        peak * 100, STEP_SETTLE_BANDS[0] * 100, settled[0], STEP_SETTLE_BANDS[1] * 100, settled[1], final);
+  }
+
+  double getWallTime() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+  }
+
+  void printSummary(double wallTime, uint64_t loopPasses) {
+    uint64_t seconds = Sim::now() / 1000000;
+    const Sim::ModelState &model = Sim::getModelState();
+    fprintf(stderr, "simulated %llu:%02llu:%02llu in %.2f s (%.0fx real time), %llu loop passes\n",
+        (unsigned long long) seconds / 3600, (unsigned long long) seconds / 60 % 60,
+        (unsigned long long) seconds % 60, wallTime, wallTime > 0 ? Sim::now() / 1e6 / wallTime : 0,
+        (unsigned long long) loopPasses);
+    fprintf(stderr, "source %.0f mV, %.1f%% charge left, heat sink %.1f C, firmware measured %.1f C in %lu conversions\n",
+        model.voltage, model.stateOfCharge * 100, model.heatSinkTemperature,
+        SystemState::getAverageTemperature() / 10.0, (unsigned long) Sim::getAdcConversions());
+    fprintf(stderr, "drawn %.1f mAh %.1f mWh, firmware counted %.1f mAh %.1f mWh\n",
+        model.charge, model.energy, SystemState::getAverageCharge(), SystemState::getAverageEnergy());
+    fprintf(stderr, "emergency 0x%04x\n", EmergencyManager::getEmergency());
+    if (model.trips != 0 || EmergencyManager::getTripReason() != 0) {
+      fprintf(stderr, "trip reason 0x%04x, %u over current trips, last %u us max %u us from crossing %u mA"
+          " to load off, firmware %u us from sample tick\n",
+          EmergencyManager::getTripReason(), model.trips, model.lastTripLatency, model.maxTripLatency,
+          TRIP_AMPERAGE, EmergencyManager::getTripLatency());
+    }
+    if (!Sim::getPin(AMPERAGE_ON_OFF_PIN) && model.offVoltage != 0) {
+      fprintf(stderr, "load switched off at %.0f mV\n", model.offVoltage);
+    }
+    fprintf(stderr, "gauge late %u lost %u samples, max latency %u us\n", GaugeReader::getLateSamples(),
+        GaugeReader::getDroppedSamples(), GaugeReader::getMaxLatency());
+    uint16_t internalResistance = AmperagePinManager::getInternalResistance();
+    if (internalResistance != 0) {
+      fprintf(stderr, "internal resistance %.1f mOhm\n", internalResistance / 10.0);
+    } else {
+      fprintf(stderr, "internal resistance not measured\n");
+    }
+    const TransientEdges &edges = transientEdges;
+    if (edges.count != 0) {
+      uint32_t jitter = 0;
+      for (uint8_t i = 0; i < 2; ++i) {
+        if (edges.maxLength[i] != 0) {
+          jitter = max(jitter, edges.maxLength[i] - edges.minLength[i]);
+        }
+      }
+      fprintf(stderr, "transient %u edges, low %u..%u us, high %u..%u us, jitter %u us\n", edges.count,
+          edges.minLength[0], edges.maxLength[0], edges.minLength[1], edges.maxLength[1], jitter);
+    }
+    const TransientRecovery &recovery = transientRecovery;
+    if (recovery.edges[0] != 0 && recovery.edges[1] != 0) {
+      fprintf(stderr, "transient recovery");
+      for (int8_t edge = 1; edge >= 0; --edge) {
+        fprintf(stderr, "%s model %.0f..%.0f us", edge ? ", rising" : ", falling",
+            recovery.min[edge], recovery.max[edge]);
+        TransientLoad::EdgeResponse response;
+        if (TransientLoad::getEdgeResponse(edge, response)) {
+          fprintf(stderr, " firmware %u+-%u us", response.recoveryTime, response.recoveryUncertainty);
+        }
+      }
+      fprintf(stderr, "\n");
+    }
+    const DisplayFrame::Stats &display = displayFrame.getStats();
+    fprintf(stderr, "display %u frames, %lu bytes (bus %lu), max %u bytes %u us per frame\n",
+        display.frames, (unsigned long) display.totalBytes,
+        simulatedDisplay ? (unsigned long) simulatedDisplay->getBusBytes() : 0UL, display.maxBytes, display.maxTime);
+    fprintf(stderr, "task wcet(us) overruns:");
+    TaskScheduler::Task task;
+    for (uint8_t i = 0; i < TaskScheduler::getTaskCount(); ++i) {
+      TaskScheduler::getTask(i, task);
+      const TaskScheduler::TaskStats &stats = TaskScheduler::getStats(i);
+      fprintf(stderr, " %s %u %u", task.name, stats.worstExecutionTime, stats.overruns);
+    }
+    fprintf(stderr, "\n");
+    uint64_t totalRuns = 0;
+    fprintf(stderr, "task runs per 1000 loop passes:");
+    for (uint8_t i = 0; i < taskRuns.size(); ++i) {
+      TaskScheduler::getTask(i, task);
+      totalRuns += taskRuns[i];
+      fprintf(stderr, " %s %.1f", task.name, loopPasses ? taskRuns[i] * 1000.0 / loopPasses : 0);
+    }
+    fprintf(stderr, ", %.2f task runs per pass\n", loopPasses ? (double) totalRuns / loopPasses : 0);
+  }
+
+  void printEepromWear() {
+    uint32_t total = 0;
+    uint32_t maxWrites = 0;
+    int maxAddress = 0;
+    for (int address = 0; address < EEPROM.length(); ++address) {
+      uint32_t writes = EEPROM.getWriteCount(address);
+      total += writes;
+      if (writes > maxWrites) {
+        maxWrites = writes;
+        maxAddress = address;
+      }
+    }
+    fprintf(stderr, "eeprom %lu byte writes, most worn cell %d written %lu times\n",
+        (unsigned long) total, maxAddress, (unsigned long) maxWrites);
+  }
+
+  void printScreen() {
+    if (!simulatedDisplay) {
+      return;
+    }
+    for (uint8_t row = 0; row < SSD1306Ascii::ROWS; ++row) {
+      fprintf(stderr, "|%s|\n", simulatedDisplay->getRow(row));
+    }
+  }
+};
+
+int main(int argc, char **argv) {
+  Options options;
+  if (!parseOptions(argc, argv, options)) {
+    printUsage(argv[0]);
+    return 1;
+  }
+  FILE *telemetry = NULL;
+  if (options.telemetryFile) {
+    telemetry = fopen(options.telemetryFile, "wb");
+    if (!telemetry) {
+      fprintf(stderr, "Can not write %s\n", options.telemetryFile);
+      return 1;
+    }
+  }
+
+  if (options.eepromFile && !EEPROM.load(options.eepromFile)) {
+    fprintf(stderr, "Can not read %s\n", options.eepromFile);
+    return 1;
+  }
+  Sim::setup(options.model);
+  Sim::setSdDirectory(options.sdDirectory);
+  Sim::setSerialOutput(options.isQuiet ? NULL : stdout);
+  Sim::setTelemetryOutput(telemetry);
+  Sim::setDutyCycleObserver(recordTransientEdge);
+
+  double startTime = getWallTime();
+  setup();
+
+  uint64_t scriptStart = Sim::now();
+  if (options.faultTime >= 0) {
+    Sim::injectFault(scriptStart + (uint64_t) (options.faultTime * 1e6), options.faultAmperage);
+  }
+  if (options.rampTime >= 0) {
+    Sim::rampSourceVoltage(scriptStart + (uint64_t) (options.rampTime * 1e6), options.rampVoltage,
+        (uint64_t) (options.rampDuration * 1e3));
+  }
+  uint64_t endTime = scriptStart + (uint64_t) (options.hours * 3600e6);
+  size_t scriptLine = 0;
+  bool wasOn = false;
+  uint64_t offTime = 0;
+  uint64_t loopPasses = 0;
+  while (Sim::now() < endTime) {
+    while (scriptLine < options.script.size()
+        && options.script[scriptLine].time <= Sim::now() - scriptStart) {
+      Sim::sendSerialInput(options.script[scriptLine++].command.c_str());
+    }
+
+    loop();
+    ++loopPasses;
+    countTaskRuns();
+    recordStep(options, Sim::now() - scriptStart);
+    recordTransientVoltage();
+
+    // Stop once load switched itself off, e.g. on stop voltage
+    if (Sim::getPin(AMPERAGE_ON_OFF_PIN)) {
+      wasOn = true;
+      offTime = 0;
+    } else if (wasOn && !options.isKeepRunning && scriptLine == options.script.size()) {
+      if (offTime == 0) {
+        offTime = Sim::now();
+      } else if (Sim::now() - offTime > 2 * REFRESH_INTERVAL_MS * 1000ULL) {
+        break;
+      }
+    }
+
+    uint64_t step = options.loopCost;
+    if (step == 0) {
+      uint64_t next = min(Sim::getNextEventTime(), endTime);
+      step = next > Sim::now() ? next - Sim::now() : 0;
+    }
+    Sim::advance(step);
+  }
+
+  fflush(stdout);
+  printSummary(getWallTime() - startTime, loopPasses);
+  printStepResponse(options.stepAmperage);
+  printEepromWear();
+  if (options.eepromFile && !EEPROM.save(options.eepromFile)) {
+    fprintf(stderr, "Can not write %s\n", options.eepromFile);
+  }
+  if (options.isScreenPrinted) {
+    printScreen();
+  }
+  if (telemetry) {
+    fclose(telemetry);
+  }
+  return 0;
+}
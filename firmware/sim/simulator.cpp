@@ -0,0 +1,639 @@
+#include <math.h>
+#include <string>
+
+#include <Arduino.h>
+
+#include <util/twi.h>
+
+#include "simulator.h"
+#include "../src/constants.h"
+
+extern "C" void TIMER1_OVF_vect(void) __attribute__((weak));
+extern "C" void USART_UDRE_vect(void) __attribute__((weak));
+extern "C" void ADC_vect(void) __attribute__((weak));
+extern "C" void TWI_vect(void) __attribute__((weak));
+
+volatile uint8_t SREG;
+volatile uint8_t TCCR1A;
+volatile uint8_t TCCR1B;
+volatile uint8_t TIMSK1;
+volatile uint16_t OCR1B;
+volatile uint16_t ICR1;
+volatile uint8_t TCCR2A;
+volatile uint8_t TCCR2B;
+volatile uint8_t OCR2A;
+volatile uint8_t OCR2B;
+volatile uint8_t ADMUX;
+volatile uint8_t ADCSRA;
+volatile uint8_t ADCSRB;
+volatile uint16_t ADC;
+volatile uint8_t UCSR0A;
+volatile uint8_t UCSR0B;
+volatile uint8_t UCSR0C;
+volatile uint16_t UBRR0;
+volatile uint8_t UDR0;
+TwiControlRegister TWCR;
+volatile uint8_t TWDR;
+volatile uint8_t TWSR;
+volatile uint8_t TWBR;
+
+namespace Sim {
+  namespace {
+    // Li-ion cell open circuit voltage from 0% to 100% charge in 10% steps
+    const double CELL_VOLTAGE[] = {3000, 3450, 3550, 3620, 3680, 3740, 3820, 3900, 3980, 4080, 4200};
+    const double CONTROL_TIME_CONSTANT = 1e-3; // s, pwm filter and op-amps
+    const double POLARIZATION_TIME_CONSTANT = 30; // s
+    const double LOAD_RESISTANCE = 50; // mOhm, shunts, mosfets and wires at full gate drive
+    const double HEAT_CAPACITY = 150; // J/K of heat sink
+    const double THERMAL_RESISTANCE_STILL = 1.2; // K/W
+    const double THERMAL_RESISTANCE_FAN = 0.35; // K/W at full fan speed
+    // Byte and acknowledge
+    const uint32_t TWI_BYTE_BITS = 9;
+    // 13 ADC clocks, ADC clock is 16 MHz divided by ADPS prescaler
+    const uint32_t ADC_CONVERSION_CYCLES = 13;
+    const uint8_t ADC_TRIGGER_TIMER1_OVERFLOW = _BV(ADTS2) | _BV(ADTS1);
+
+    ModelConfig config;
+    ModelState model;
+    double polarization; // mV
+
+    uint64_t clock = 0;
+    uint32_t advanceDepth = 0; // above 0 while interrupts run
+    uint64_t modelTime = 0;
+    uint64_t nextTick = 0;
+    bool isTimerRunning = false;
+    uint16_t latchedDutyCycle = 0;
+    void (*dutyCycleObserver)(uint64_t time, uint16_t from, uint16_t to) = NULL;
+    uint8_t pins[32];
+    uint32_t noiseState = 1;
+    uint64_t faultTime = UINT64_MAX;
+    double faultAmperage = 0; // mA
+    struct {
+      uint64_t start; // us
+      uint64_t duration; // us
+      double from; // mV
+      double to; // mV
+    } ramp = {UINT64_MAX, 0, 0, 0};
+    double overCurrentTime = 0; // us, when model crossed TRIP_AMPERAGE, 0 if below
+
+    // TWI master and slaves on the bus: INA219 serves register reads and
+    // writes, display takes whatever it gets. Stop takes a bit time on the
+    // bus but TWSTO clears right away.
+    struct {
+      uint8_t control; // TWCR without TWINT and TWSTO
+      bool isInterruptFlag; // TWINT
+      bool isPending; // start or byte in flight
+      uint64_t completion; // us
+      uint8_t status; // TW_STATUS once done
+      uint8_t received; // TWDR once done, reads only
+      uint64_t busFree; // us, bit time after the last stop
+      bool isBusOwned; // start sent, no stop since
+      bool isAddressNext;
+      bool isReading;
+      uint8_t address; // slave that acknowledged, 0 if none
+      uint8_t dataBytes; // since address
+      uint8_t ina219Pointer;
+      uint16_t ina219Value; // register being read or written
+    } twi;
+
+    struct {
+      bool isPending;
+      uint64_t completion;
+      uint32_t conversions;
+    } adc;
+
+    // INA219 in continuous mode converts shunt and bus voltage in turns,
+    // free running, each register holds the mean over its last conversion
+    struct {
+      uint64_t conversionEnd; // us
+      bool isBusConversion;
+      double startValue; // register LSBs at conversion start
+      uint16_t shuntVoltage;
+      uint16_t busVoltage;
+    } ina219;
+
+    // Bytes in flight of HardwareSerial, the one in the shift register too
+    const uint32_t SERIAL_TX_BUFFER_SIZE = 64;
+
+    FILE *serialOutput = stdout;
+    double serialByteTime = 0; // us, 0 before Serial.begin()
+    double serialTxEnd = 0; // us, when the last written byte leaves UART
+    FILE *telemetryOutput = NULL;
+    std::string serialInput;
+    size_t serialInputPosition = 0;
+    const char *sdDirectory = NULL;
+    int16_t encoderSteps = 0;
+    uint8_t encoderButton = 0;
+
+    int noise(uint8_t amplitude) {
+      if (amplitude == 0) {
+        return 0;
+      }
+      noiseState = noiseState * 1103515245 + 12345;
+      return (int) ((noiseState >> 16) % (2 * amplitude + 1)) - amplitude;
+    }
+
+    double getOpenCircuitVoltage() {
+      const SourceConfig &source = config.source;
+      if (!source.isBattery) {
+        if (clock < ramp.start) {
+          return source.voltage;
+        }
+        if (clock >= ramp.start + ramp.duration) {
+          return ramp.to;
+        }
+        return ramp.from + (ramp.to - ramp.from) * (clock - ramp.start) / ramp.duration;
+      }
+      double soc = model.stateOfCharge;
+      double cellVoltage;
+      if (soc <= 0) {
+        cellVoltage = max(0.0, CELL_VOLTAGE[0] + soc * 20000);
+      } else if (soc >= 1) {
+        cellVoltage = CELL_VOLTAGE[10];
+      } else {
+        int index = soc * 10;
+        double fraction = soc * 10 - index;
+        cellVoltage = CELL_VOLTAGE[index] + (CELL_VOLTAGE[index + 1] - CELL_VOLTAGE[index]) * fraction;
+      }
+      return cellVoltage * source.cells;
+    }
+
+    double getTargetAmperage() {
+      if (!pins[AMPERAGE_ON_OFF_PIN]) {
+        return 0;
+      }
+      double amperage = (double) latchedDutyCycle * MAX_CURRENT_MA / MAX_PWM_DUTY_CYCLE;
+      double fault = clock >= faultTime ? faultAmperage : 0;
+      return max(0.0, amperage * config.amperageGain + config.amperageOffset + fault);
+    }
+
+    double getThermalResistance() {
+      if (!pins[FAN_ON_OFF_PIN]) {
+        return THERMAL_RESISTANCE_STILL;
+      }
+      double fanSpeed = OCR2A ? min(1.0, (double) OCR2B / OCR2A) : 1;
+      return THERMAL_RESISTANCE_STILL + (THERMAL_RESISTANCE_FAN - THERMAL_RESISTANCE_STILL) * (0.3 + 0.7 * fanSpeed);
+    }
+
+    void updateModel(uint64_t time) {
+      double dt = (time - modelTime) / 1e6; // s
+      modelTime = time;
+      if (dt <= 0) {
+        return;
+      }
+
+      double openCircuitVoltage = getOpenCircuitVoltage();
+      double sourceResistance = config.source.resistance;
+      double maxAmperage = max(0.0, openCircuitVoltage - polarization) * 1000 / (sourceResistance + LOAD_RESISTANCE);
+      double targetAmperage = min(getTargetAmperage(), maxAmperage);
+      double startAmperage = model.amperage;
+      model.amperage += (targetAmperage - model.amperage) * (1 - exp(-dt / CONTROL_TIME_CONSTANT));
+      if (startAmperage < TRIP_AMPERAGE && model.amperage >= TRIP_AMPERAGE) {
+        // Exact crossing time on the exponential, events can be far apart
+        double crossing = -CONTROL_TIME_CONSTANT
+            * log((targetAmperage - TRIP_AMPERAGE) / (targetAmperage - startAmperage));
+        overCurrentTime = time - dt * 1e6 + crossing * 1e6;
+      } else if (model.amperage < TRIP_AMPERAGE) {
+        overCurrentTime = 0;
+      }
+
+      if (config.source.isBattery) {
+        double polarizationResistance = sourceResistance / 2;
+        polarization += (model.amperage * polarizationResistance / 1000 - polarization)
+            * (1 - exp(-dt / POLARIZATION_TIME_CONSTANT));
+        model.stateOfCharge -= model.amperage * dt / 3600 / config.source.capacity;
+      }
+      model.voltage = max(0.0, openCircuitVoltage - polarization - model.amperage * sourceResistance / 1000);
+
+      double hours = dt / 3600;
+      model.charge += model.amperage * hours;
+      model.energy += model.amperage * model.voltage / 1000 * hours;
+
+      double power = model.amperage * model.voltage / 1e6; // W
+      double cooling = (model.heatSinkTemperature - config.ambientTemperature) / getThermalResistance();
+      model.heatSinkTemperature += (power - cooling) * dt / HEAT_CAPACITY;
+    }
+
+    uint16_t getThermistorAdc() {
+      double kelvin = model.heatSinkTemperature + 273.15;
+      double resistance = THERMISTOR_NOMINAL
+          * exp(B_COEFFICIENT * (1 / kelvin - 1 / (TEMPERATURE_NOMINAL + 273.15)));
+      double adc = 1023 / (1 + THERMISTOR_SERIES_RESISTOR / resistance);
+      return constrain((int) lround(adc) + noise(config.noise), 0, 1023);
+    }
+
+    // Ideal INA219, so firmware calibration shows up as its ~1% correction.
+    // Bus voltage is seen behind shunt and wires.
+    double getIna219Value(bool isBusVoltage) {
+      if (isBusVoltage) {
+        return (model.voltage - model.amperage * 24 / 1000 - 43) / 4;
+      }
+      return model.amperage * 5 / 3;
+    }
+
+    // Phase in us into a shunt and bus conversion pair
+    void startIna219(uint32_t phase) {
+      phase %= 2 * INA219_CONVERSION_US;
+      ina219.isBusConversion = phase >= INA219_CONVERSION_US;
+      ina219.startValue = getIna219Value(ina219.isBusConversion);
+      ina219.conversionEnd = clock + INA219_CONVERSION_US - phase % INA219_CONVERSION_US;
+      ina219.shuntVoltage = lround(getIna219Value(false));
+      ina219.busVoltage = (uint16_t) lround(getIna219Value(true)) << 3 | 0x02;
+    }
+
+    // Mean of the conversion from its ends, the model barely bends in 532 us
+    void completeIna219Conversion() {
+      double value = (ina219.startValue + getIna219Value(ina219.isBusConversion)) / 2;
+      if (ina219.isBusConversion) {
+        int32_t busVoltage = constrain((int32_t) lround(value) + noise(config.noise), 0, 8000);
+        ina219.busVoltage = busVoltage << 3 | 0x02;
+      } else { // saturates at 320 mV
+        ina219.shuntVoltage = constrain(lround(value) + noise(config.noise), -32000L, 32000L);
+      }
+      ina219.isBusConversion = !ina219.isBusConversion;
+      ina219.startValue = getIna219Value(ina219.isBusConversion);
+      ina219.conversionEnd += INA219_CONVERSION_US;
+    }
+
+    uint16_t readIna219(uint8_t reg) {
+      switch (reg) {
+        case 0x01:
+          return ina219.shuntVoltage;
+        case 0x02:
+          return ina219.busVoltage;
+        default:
+          return 0;
+      }
+    }
+
+    void startAdcConversion() {
+      if (adc.isPending || !(ADCSRA & _BV(ADEN))) {
+        return;
+      }
+      uint8_t prescaler = 1 << max(1, ADCSRA & 0x07);
+      adc.isPending = true;
+      adc.completion = clock + max(1U, ADC_CONVERSION_CYCLES * prescaler / 16);
+    }
+
+    void completeAdc() {
+      adc.isPending = false;
+      ++adc.conversions;
+      ADC = getThermistorAdc();
+      ADCSRA &= ~_BV(ADSC);
+      if (ADCSRA & _BV(ADIE) && ADC_vect) {
+        ADC_vect();
+      } else {
+        ADCSRA |= _BV(ADIF);
+      }
+    }
+
+    double getTwiBitTime() {
+      uint8_t prescaler = 1 << 2 * (TWSR & (_BV(TWPS0) | _BV(TWPS1)));
+      return (16.0 + 2.0 * TWBR * prescaler) * 1e6 / F_CPU; // us
+    }
+
+    void scheduleTwi(uint64_t start, uint32_t bits, uint8_t status) {
+      twi.isPending = true;
+      twi.completion = start + (uint64_t) ceil(bits * getTwiBitTime());
+      twi.status = status;
+    }
+
+    // Byte in TWDR goes out, or one comes in when master reads
+    void transferTwiByte() {
+      if (twi.isAddressNext) {
+        twi.isAddressNext = false;
+        twi.isReading = TWDR & TW_READ;
+        uint8_t address = TWDR >> 1;
+        bool isAck = address == INA219_I2C_ADDRESS || address == DISPLAY_I2C_ADDRESS;
+        twi.address = isAck ? address : 0;
+        twi.dataBytes = 0;
+        uint8_t status = twi.isReading ? (isAck ? TW_MR_SLA_ACK : TW_MR_SLA_NACK)
+            : (isAck ? TW_MT_SLA_ACK : TW_MT_SLA_NACK);
+        scheduleTwi(clock, TWI_BYTE_BITS, status);
+        return;
+      }
+      bool isIna219 = twi.address == INA219_I2C_ADDRESS;
+      if (twi.isReading) {
+        // INA219 takes the register on the first byte, high byte goes first
+        if (isIna219 && twi.dataBytes == 0) {
+          twi.ina219Value = readIna219(twi.ina219Pointer);
+        }
+        twi.received = 0xFF; // nobody drives the bus
+        if (isIna219) {
+          twi.received = twi.dataBytes == 0 ? twi.ina219Value >> 8 : twi.ina219Value & 0xFF;
+        }
+        scheduleTwi(clock, TWI_BYTE_BITS, twi.control & _BV(TWEA) ? TW_MR_DATA_ACK : TW_MR_DATA_NACK);
+      } else {
+        if (isIna219 && twi.dataBytes == 0) {
+          twi.ina219Pointer = TWDR; // written configuration is fixed in the model
+        }
+        scheduleTwi(clock, TWI_BYTE_BITS, twi.address ? TW_MT_DATA_ACK : TW_MT_DATA_NACK);
+      }
+      ++twi.dataBytes;
+    }
+
+    void writeTwiControl(uint8_t value) {
+      twi.control = value & ~(_BV(TWINT) | _BV(TWSTO));
+      if (!(value & _BV(TWEN))) {
+        twi.isPending = twi.isInterruptFlag = twi.isBusOwned = false;
+        return;
+      }
+      if (!(value & _BV(TWINT))) {
+        return; // writing one clears the flag and starts next action
+      }
+      if (twi.isPending) {
+        fprintf(stderr, "TWCR written at %llu us while transfer is in flight\n", (unsigned long long) clock);
+        abort();
+      }
+      twi.isInterruptFlag = false;
+      if (value & _BV(TWSTO) && twi.isBusOwned) {
+        twi.isBusOwned = false;
+        twi.busFree = clock + (uint64_t) ceil(getTwiBitTime());
+      }
+      if (value & _BV(TWSTA)) {
+        uint8_t status = twi.isBusOwned ? TW_REP_START : TW_START;
+        scheduleTwi(max(clock, twi.busFree), 1, status);
+        twi.isBusOwned = true;
+        twi.isAddressNext = true;
+      } else if (twi.isBusOwned) {
+        transferTwiByte();
+      }
+    }
+
+    void completeTwi() {
+      twi.isPending = false;
+      if (twi.status == TW_MR_DATA_ACK || twi.status == TW_MR_DATA_NACK) {
+        TWDR = twi.received;
+      }
+      TWSR = (TWSR & (_BV(TWPS0) | _BV(TWPS1))) | twi.status;
+      twi.isInterruptFlag = true;
+      if (twi.control & _BV(TWIE) && TWI_vect) {
+        TWI_vect();
+      }
+    }
+
+    void tickTimer() {
+      // Fast PWM takes new OCR1B at the end of period
+      if (OCR1B != latchedDutyCycle && dutyCycleObserver) {
+        dutyCycleObserver(clock, latchedDutyCycle, OCR1B);
+      }
+      latchedDutyCycle = OCR1B;
+      // Conversion started by ADSC is only seen at the next tick
+      bool isAutoTriggered = ADCSRA & _BV(ADATE) && (ADCSRB & 0x07) == ADC_TRIGGER_TIMER1_OVERFLOW;
+      if (ADCSRA & _BV(ADSC) || isAutoTriggered) {
+        startAdcConversion();
+      }
+      if (TIMSK1 & _BV(TOIE1) && TIMER1_OVF_vect) {
+        TIMER1_OVF_vect();
+      }
+    }
+
+    void drainUart() {
+      while (UCSR0B & _BV(UDRIE0) && USART_UDRE_vect) {
+        USART_UDRE_vect();
+        if (telemetryOutput) {
+          fputc(UDR0, telemetryOutput);
+        }
+      }
+    }
+
+    void updateTimer() {
+      bool isRunning = TCCR1B & (_BV(CS10) | _BV(CS11) | _BV(CS12));
+      if (isRunning && !isTimerRunning) {
+        nextTick = clock + (ICR1 + 1) / 16;
+      }
+      isTimerRunning = isRunning;
+      if (!isRunning) {
+        latchedDutyCycle = OCR1B;
+      }
+    }
+
+    uint32_t getSerialTxBytes() {
+      if (serialByteTime == 0 || serialTxEnd <= clock) {
+        return 0;
+      }
+      return (uint32_t) ceil((serialTxEnd - clock) / serialByteTime);
+    }
+
+    // Latency from current crossing TRIP_AMPERAGE to load switched off
+    void switchedOff(uint8_t pin) {
+      if (pin != AMPERAGE_ON_OFF_PIN || !pins[pin]) {
+        return;
+      }
+      updateModel(clock);
+      model.offVoltage = model.voltage;
+      if (overCurrentTime == 0) {
+        return;
+      }
+      model.lastTripLatency = clock - overCurrentTime;
+      model.maxTripLatency = max(model.maxTripLatency, model.lastTripLatency);
+      ++model.trips;
+      overCurrentTime = 0;
+    }
+  };
+
+  void setup(const ModelConfig &modelConfig) {
+    config = modelConfig;
+    model = ModelState();
+    model.stateOfCharge = config.source.stateOfCharge;
+    model.heatSinkTemperature = config.ambientTemperature;
+    model.voltage = getOpenCircuitVoltage();
+    noiseState = config.seed;
+    // Conversions are not in step with Timer1, seed picks their phase
+    startIna219(config.seed * 2654435761U >> 16);
+  }
+
+  void injectFault(uint64_t time, double amperage) {
+    faultTime = time;
+    faultAmperage = amperage;
+  }
+
+  void rampSourceVoltage(uint64_t time, double voltage, uint64_t duration) {
+    ramp = {time, duration, config.source.voltage, voltage};
+  }
+
+  uint64_t now() {
+    return clock;
+  }
+
+  uint64_t getNextEventTime() {
+    updateTimer();
+    uint64_t next = UINT64_MAX;
+    if (isTimerRunning) {
+      next = nextTick;
+    }
+    if (twi.isPending && twi.completion < next) {
+      next = twi.completion;
+    }
+    if (adc.isPending && adc.completion < next) {
+      next = adc.completion;
+    }
+    if (ina219.conversionEnd < next) {
+      next = ina219.conversionEnd;
+    }
+    return next;
+  }
+
+  void advance(uint64_t us) {
+    uint64_t target = clock + us;
+    ++advanceDepth;
+    drainUart();
+    for (uint64_t next = getNextEventTime(); next <= target; next = getNextEventTime()) {
+      clock = next;
+      updateModel(clock);
+      if (ina219.conversionEnd == clock) {
+        completeIna219Conversion();
+      } else if (twi.isPending && twi.completion == clock) {
+        completeTwi();
+      } else if (adc.isPending && adc.completion == clock) {
+        completeAdc();
+      } else {
+        tickTimer();
+        nextTick += (ICR1 + 1) / 16;
+      }
+      drainUart();
+    }
+    clock = target;
+    updateModel(clock);
+    --advanceDepth;
+  }
+
+  void endAtomicBlock() {
+    if (advanceDepth == 0) {
+      advance(1);
+    }
+  }
+
+  // Polling loop lets the transfer go on, interrupts included
+  uint8_t readTwiControl() {
+    if (twi.isPending && advanceDepth == 0) {
+      advance(1);
+    }
+    return twi.control | (twi.isInterruptFlag ? _BV(TWINT) : 0);
+  }
+
+  const ModelState &getModelState() {
+    return model;
+  }
+
+  uint8_t getPin(uint8_t pin) {
+    return pins[pin];
+  }
+
+  uint16_t getLatchedDutyCycle() {
+    return latchedDutyCycle;
+  }
+
+  void setDutyCycleObserver(void (*observer)(uint64_t time, uint16_t from, uint16_t to)) {
+    dutyCycleObserver = observer;
+  }
+
+  uint32_t getAdcConversions() {
+    return adc.conversions;
+  }
+
+  void sendSerialInput(const char *line) {
+    serialInput.erase(0, serialInputPosition);
+    serialInputPosition = 0;
+    serialInput += line;
+    serialInput += '\n';
+  }
+
+  void setSerialOutput(FILE *output) {
+    serialOutput = output;
+  }
+
+  void setTelemetryOutput(FILE *output) {
+    telemetryOutput = output;
+  }
+
+  void setSdDirectory(const char *path) {
+    sdDirectory = path;
+  }
+
+  void queueEncoder(int16_t steps, uint8_t button) {
+    encoderSteps += steps;
+    encoderButton = button;
+  }
+
+  void beginSerial(uint32_t baudRate) {
+    serialByteTime = 10e6 / baudRate; // start, 8 data and stop bits
+    serialTxEnd = clock;
+  }
+
+  int availableForWriteSerial() {
+    uint32_t bytes = getSerialTxBytes();
+    return SERIAL_TX_BUFFER_SIZE - 1 - (bytes == 0 ? 0 : bytes - 1);
+  }
+
+  // Arduino core waits for room in the transmit buffer, interrupts go on
+  void writeSerial(uint8_t value) {
+    if (serialByteTime != 0) {
+      if (getSerialTxBytes() >= SERIAL_TX_BUFFER_SIZE) {
+        double roomTime = serialTxEnd - (SERIAL_TX_BUFFER_SIZE - 1) * serialByteTime;
+        advance((uint64_t) ceil(roomTime) - clock);
+      }
+      serialTxEnd = max(serialTxEnd, (double) clock) + serialByteTime;
+    }
+    if (serialOutput) {
+      fputc(value, serialOutput);
+    }
+  }
+
+  int readSerial(bool isPeek) {
+    if (serialInputPosition >= serialInput.size()) {
+      return -1;
+    }
+    uint8_t value = serialInput[serialInputPosition];
+    if (!isPeek) {
+      ++serialInputPosition;
+    }
+    return value;
+  }
+
+  int availableSerial() {
+    return serialInput.size() - serialInputPosition;
+  }
+
+  const char *getSdDirectory() {
+    return sdDirectory;
+  }
+
+  int16_t takeEncoderSteps() {
+    int16_t steps = encoderSteps;
+    encoderSteps = 0;
+    return steps;
+  }
+
+  uint8_t takeEncoderButton() {
+    uint8_t button = encoderButton;
+    encoderButton = 0;
+    return button;
+  }
+};
+
+TwiControlRegister &TwiControlRegister::operator=(uint8_t value) {
+  Sim::writeTwiControl(value);
+  return *this;
+}
+
+TwiControlRegister::operator uint8_t() const {
+  return Sim::readTwiControl();
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {}
+
+void digitalWrite(uint8_t pin, uint8_t value) {
+  if (value == LOW) {
+    Sim::switchedOff(pin);
+  }
+  Sim::pins[pin] = value != LOW;
+}
+
+int digitalRead(uint8_t pin) {
+  return Sim::pins[pin];
+}
+
+int analogRead(uint8_t pin) {
+  return 512 + Sim::noise(8);
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Native build of the firmware runs against simulated hardware. Time is
+// virtual: loop() passes take no time unless loopCost is set, and the clock
+// jumps to the next interrupt between passes, so hours of discharge take
+// seconds. Interrupt vectors are called between loop() passes and where
+// firmware waits for hardware: TWI polling, full serial buffer and the end
+// of an atomic block, which takes 1 us.
+namespace Sim {
+  // Voltage source connected to the load: battery pack or power supply
+  struct SourceConfig {
+    bool isBattery;
+    uint8_t cells;
+    double capacity; // mAh
+    double stateOfCharge; // 0..1 at start
+    double resistance; // mOhm, whole pack
+    double voltage; // mV, power supply only
+  };
+
+  struct ModelConfig {
+    SourceConfig source;
+    double ambientTemperature; // *C
+    double amperageGain; // control stage error, 1 is ideal
+    int32_t amperageOffset; // mA
+    uint8_t noise; // sensor noise amplitude, register LSB
+    uint32_t seed;
+  };
+
+  struct ModelState {
+    double amperage; // mA through the load
+    double voltage; // mV on terminals
+    double stateOfCharge;
+    double heatSinkTemperature; // *C
+    double charge; // mAh drawn
+    double energy; // mWh drawn
+    uint32_t trips; // load switched off while over TRIP_AMPERAGE
+    uint32_t lastTripLatency; // us from crossing TRIP_AMPERAGE to switch off
+    uint32_t maxTripLatency; // us
+    double offVoltage; // mV on terminals when load was switched off last
+  };
+
+  void setup(const ModelConfig &config);
+
+  uint64_t now(); // us
+  // Moves clock forward, running interrupts which become due
+  void advance(uint64_t us);
+  uint64_t getNextEventTime();
+  // Control stage adds amperage from time on while load is switched on,
+  // as a shorted mosfet would
+  void injectFault(uint64_t time, double amperage);
+  // Power supply voltage moves linearly to voltage (mV) from time on and
+  // reaches it after duration (us)
+  void rampSourceVoltage(uint64_t time, double voltage, uint64_t duration);
+
+  const ModelState &getModelState();
+  uint8_t getPin(uint8_t pin);
+  uint16_t getLatchedDutyCycle();
+  // Called when timer takes a new OCR1B at the end of pwm period
+  void setDutyCycleObserver(void (*observer)(uint64_t time, uint16_t from, uint16_t to));
+  uint32_t getAdcConversions();
+
+  // Host side peripherals
+  void sendSerialInput(const char *line);
+  void setSerialOutput(FILE *output); // NULL drops firmware output
+  void setTelemetryOutput(FILE *output);
+  void setSdDirectory(const char *path); // NULL means no card
+  void queueEncoder(int16_t steps, uint8_t button);
+
+  // Called by fake peripherals
+  void beginSerial(uint32_t baudRate);
+  int availableForWriteSerial();
+  void writeSerial(uint8_t value);
+  int readSerial(bool isPeek);
+  int availableSerial();
+  const char *getSdDirectory();
+  int16_t takeEncoderSteps();
+  uint8_t takeEncoderButton();
+  void endAtomicBlock(); // lets interrupts in, see util/atomic.h
+};
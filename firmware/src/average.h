@@ -1,52 +1,203 @@
 #pragma once
 
-template<typename ValueType, typename AccumType>
-struct AverageValueCalculator { 
-  AccumType accumulator = 0;
-  uint16_t counter = 0;
+#include <stdint.h>
 
-  void addMeasurement(ValueType val) {
-    accumulator += val;
-    counter += 1;
-  }
+// Statistics for StreamingStats. Window statistics are published when a
+// window is closed, others follow every sample. Each policy is a base of
+// StreamingStats, so policies which are not listed cost nothing. Host side
+// benchmark is tools/stats_bench.cpp, so no Arduino headers here.
+namespace Statistics {
+  // Mean of the window
+  template<typename ValueType, typename AccumType>
+  struct Mean {
+    AccumType sum = 0;
+    ValueType averageValue = 0;
 
-  ValueType calculateAverageValue() {
-    ValueType avg = counter == 0 ? 0 : (accumulator / counter);
-    accumulator = 0;
-    counter = 0;
-    return avg;
+    inline void add(ValueType val, uint16_t) {
+      sum += val;
+    }
+
+    inline bool closeWindow(uint16_t count) {
+      ValueType avg = sum / count;
+      sum = 0;
+      bool isDifferent = avg != averageValue;
+      averageValue = avg;
+      return isDifferent;
+    }
+
+    ValueType getAverageValue() {
+      return averageValue;
+    }
+  };
+
+  // Lowest and highest sample of the window
+  template<typename ValueType, typename AccumType>
+  struct MinMax {
+    ValueType windowMin = 0;
+    ValueType windowMax = 0;
+    ValueType minValue = 0;
+    ValueType maxValue = 0;
+
+    inline void add(ValueType val, uint16_t index) {
+      if (index == 0 || val < windowMin) {
+        windowMin = val;
+      }
+      if (index == 0 || val > windowMax) {
+        windowMax = val;
+      }
+    }
+
+    inline bool closeWindow(uint16_t) {
+      bool isDifferent = windowMin != minValue || windowMax != maxValue;
+      minValue = windowMin;
+      maxValue = windowMax;
+      return isDifferent;
+    }
+
+    ValueType getMinValue() {
+      return minValue;
+    }
+
+    ValueType getMaxValue() {
+      return maxValue;
+    }
+  };
+
+  inline uint16_t squareRoot(uint32_t value) {
+    uint32_t root = 0;
+    uint32_t bit = (uint32_t) 1 << 30;
+    while (bit > value) {
+      bit >>= 2;
+    }
+    while (bit != 0) {
+      if (value >= root + bit) {
+        value -= root + bit;
+        root = (root >> 1) + bit;
+      } else {
+        root >>= 1;
+      }
+      bit >>= 2;
+    }
+    return root;
   }
+
+  // Standard deviation of the window, AC RMS ripple. Deviations from the
+  // first sample of the window are summed, so there is no division per
+  // sample and sums stay small when signal is steady. Deviation is clamped
+  // to 16 bits to keep 16x16 multiplication. All math is 32 bit: square sum
+  // is halved rather than overflow, which costs its low bits only when the
+  // ripple is large anyway.
+  template<typename ValueType, typename AccumType>
+  struct Ripple {
+    ValueType reference = 0;
+    int32_t deviationSum = 0;
+    uint32_t squareSum = 0; // squares >> squareShift
+    uint8_t squareShift = 0;
+    ValueType rippleValue = 0;
+
+    inline void add(ValueType val, uint16_t index) {
+      if (index == 0) {
+        reference = val;
+      }
+      int32_t deviation = (int32_t) val - (int32_t) reference;
+      int16_t clamped = deviation > 32767 ? 32767 : deviation < -32767 ? -32767 : deviation;
+      deviationSum += clamped;
+      uint32_t square = (uint32_t) ((int32_t) clamped * clamped) >> squareShift;
+      if (squareSum > 0xFFFFFFFFUL - square) {
+        squareSum >>= 1;
+        square >>= 1;
+        ++squareShift;
+      }
+      squareSum += square;
+    }
+
+    // With deviationSum = mean * count + remainder, variance is
+    // squareSum / count - mean^2 - 2 * mean * remainder / count, the
+    // remainder^2 / count^2 term is below 1
+    inline bool closeWindow(uint16_t count) {
+      int32_t mean = deviationSum / (int32_t) count;
+      int32_t remainder = deviationSum - mean * (int32_t) count;
+      int32_t variance = (int32_t) ((squareSum / count) << squareShift) - mean * mean
+          - 2 * (mean * remainder / (int32_t) count);
+      ValueType ripple = squareRoot(variance > 0 ? variance : 0);
+      deviationSum = 0;
+      squareSum = 0;
+      squareShift = 0;
+      bool isDifferent = ripple != rippleValue;
+      rippleValue = ripple;
+      return isDifferent;
+    }
+
+    ValueType getRippleValue() {
+      return rippleValue;
+    }
+  };
+
+  // Exponential moving average with weight 1 / 2^Shift, kept scaled by
+  // 2^Shift so it needs no division. AccumType should hold
+  // max value << Shift.
+  template<uint8_t Shift>
+  struct Ema {
+    template<typename ValueType, typename AccumType>
+    struct Policy {
+      AccumType scaledValue = 0;
+      bool isStarted = false;
+
+      inline void add(ValueType val, uint16_t) {
+        if (!isStarted) {
+          scaledValue = (AccumType) val << Shift;
+          isStarted = true;
+        } else {
+          scaledValue += (AccumType) val - (scaledValue >> Shift);
+        }
+      }
+
+      inline bool closeWindow(uint16_t) {
+        return false;
+      }
+
+      ValueType getEmaValue() {
+        return scaledValue >> Shift;
+      }
+    };
+  };
 };
 
-template<typename ValueType, typename AccumType>
-struct AverageValueAccumulator : public AverageValueCalculator<ValueType, AccumType> { 
+// Instant value plus statistics chosen by policies from Statistics, e.g.
+// StreamingStats<uint16_t, uint32_t, Statistics::Mean, Statistics::MinMax>.
+template<typename ValueType, typename AccumType, template<typename, typename> class... Policies>
+struct StreamingStats : public Policies<ValueType, AccumType>... {
+  // Windows with less samples are extended to the next call
+  static const uint16_t MIN_WINDOW_SAMPLES = 10;
+
   ValueType instantValue = 0;
-  ValueType averageValue = 0;
+  uint16_t counter = 0;
 
+  // Returns true if instant value changed
   bool addMeasurement(ValueType val) {
-    AverageValueCalculator<ValueType, AccumType>::addMeasurement(val);
+    int expand[] = {0, (Policies<ValueType, AccumType>::add(val, counter), 0)...};
+    (void) expand;
+    ++counter;
     bool isDifferent = val != instantValue;
     instantValue = val;
     return isDifferent;
   }
 
+  // Returns true if any window statistic changed
   bool calculateAverageValue() {
+    if (counter < MIN_WINDOW_SAMPLES) {
+      return false;
+    }
     bool isDifferent = false;
-    if (AverageValueCalculator<ValueType, AccumType>::counter >= 10) {
-      ValueType avg = AverageValueCalculator<ValueType, AccumType>::calculateAverageValue();
-      if (avg != averageValue) {
-        isDifferent = true;
-        averageValue = avg;
-      }
+    bool changes[] = {false, Policies<ValueType, AccumType>::closeWindow(counter)...};
+    for (bool change : changes) {
+      isDifferent |= change;
     }
+    counter = 0;
     return isDifferent;
   }
 
   ValueType getInstantValue() {
     return instantValue;
   }
-
-  ValueType getAverageValue() {
-    return averageValue;
-  }
 };
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "constants.h"
+
+// Binary SD card log layout. Shared with host side decoder in tools/, so it
+// should not depend on Arduino headers. All values are little endian.
+namespace BinaryLog {
+  static const uint32_t MAGIC = 0x474C4445; // "EDLG"
+  static const uint16_t VERSION = 2; // 2 added Record::internalResistance
+
+  struct __attribute__((packed)) Header {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t headerSize;
+    uint16_t recordSize;
+    uint16_t sampleRateHz;
+    uint16_t refreshIntervalMs;
+    uint16_t feedForwardStep; // pwm duty cycle between feed-forward points
+    uint16_t feedForwardAmperage[FEED_FORWARD_POINTS]; // mA, 0xFFFF if unknown
+  };
+
+  struct __attribute__((packed)) Record {
+    uint32_t timestamp; // ms since boot
+    uint16_t instantAmperage; // mA
+    uint16_t averageAmperage; // mA
+    uint16_t instantVoltage; // mV
+    uint16_t averageVoltage; // mV
+    int16_t averageTemperature; // 0.1 *C
+    float averageCharge; // mAh
+    float averageEnergy; // mWh
+    uint16_t emergency; // EmergencyManager::EmergencyType bits
+    uint16_t internalResistance; // 0.1 mOhm, 0 if not measured yet
+  };
+
+  // Raw capture file, every gauge sample at full acquisition rate
+  static const uint32_t RAW_MAGIC = 0x57524445; // "EDRW"
+
+  struct __attribute__((packed)) RawHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t headerSize;
+    uint16_t recordSize;
+    uint16_t sampleRateHz;
+    uint32_t overrunRecords; // samples lost because both RAM buffers were full
+  };
+
+  struct __attribute__((packed)) RawRecord {
+    uint32_t timestamp; // ms since boot
+    uint16_t amperage; // mA
+    uint16_t voltage; // mV
+  };
+};
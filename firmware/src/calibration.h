@@ -0,0 +1,37 @@
+#pragma once
+
+// Piecewise-linear calibration curve. Breakpoints are known at compile time
+// so slopes are precomputed and evaluation takes one comparison per segment
+// and a single 32 bit multiplication. Values outside of the breakpoints are
+// extrapolated from the closest segment.
+template<int16_t X, int32_t Y>
+struct Breakpoint {
+  static const int16_t x = X;
+  static const int32_t y = Y;
+};
+
+template<typename... Points>
+struct Calibration;
+
+template<typename Left, typename Right>
+struct Calibration<Left, Right> {
+  static_assert(Left::x < Right::x, "Breakpoints should be sorted by x");
+
+  static const uint8_t SLOPE_BITS = 14;
+  static const int32_t SLOPE = ((Right::y - Left::y) * (1L << SLOPE_BITS) + (Right::x - Left::x) / 2)
+      / (Right::x - Left::x);
+  static_assert(SLOPE > -(2L << SLOPE_BITS) && SLOPE < (2L << SLOPE_BITS), "Segment is too steep");
+
+  static int32_t apply(int16_t x) {
+    return Left::y + (((int32_t) (x - Left::x) * SLOPE + (1L << (SLOPE_BITS - 1))) >> SLOPE_BITS);
+  }
+};
+
+template<typename Left, typename Right, typename Next, typename... Rest>
+struct Calibration<Left, Right, Next, Rest...> {
+  static int32_t apply(int16_t x) {
+    return x < Right::x
+        ? Calibration<Left, Right>::apply(x)
+        : Calibration<Right, Next, Rest...>::apply(x);
+  }
+};
@@ -1,5 +1,14 @@
 #define DISPLAY_I2C_ADDRESS 0x3C
 #define INA219_I2C_ADDRESS 0x40
+// Fast mode, INA219 takes up to 2.56MHz and SSD1306 up to 400kHz
+#define I2C_CLOCK_HZ 400000
+// 12-bit conversion time of INA219_CONFIG. Shunt and bus conversions take
+// turns and run free, not in step with Timer1, so a bus reading is 0..2
+// conversions old and spans one conversion
+#define INA219_CONVERSION_US 532
+// Longest display transfer between gauge reads, 3 + 6 * 4 bytes and their
+// addressing ~0.85ms
+#define DISPLAY_CHUNK_CHARS 4
 
 #define MENU_FONT font5x7
 
@@ -17,6 +26,10 @@
 
 #define REFRESH_INTERVAL_MS 1000
 
+// Timer1 overflow ticks every 1ms, sample rate should divide it evenly
+#define SAMPLE_TICK_HZ 1000
+#define SAMPLE_RATE_HZ 200
+
 #define THERMISTOR_PIN A7
 #define THERMISTOR_NOMINAL 47900
 #define TEMPERATURE_NOMINAL 25
@@ -40,13 +53,75 @@
 #define MAX_CURRENT_MA MAX_PWM_DUTY_CYCLE 
 #define AMPERAGE_CHANGE_CORSE_STEP 100
 #define AMPERAGE_CHANGE_FINE_STEP 1
+#define MAX_POWER_MW 200000
+#define MIN_RESISTANCE_MOHM 100
+#define MAX_RESISTANCE_MOHM 999990
+// Constant voltage mode adds 16/256 mA per mV of excess voltage every sample
+#define CONSTANT_VOLTAGE_KI_Q8 16
+// Transient edges are whole pwm periods apart, so 2..255 ms period
+#define TRANSIENT_MIN_PERIOD_MS 2
+#define TRANSIENT_CAPTURE_TICKS 16 // edge response window, ms
+#define TRANSIENT_SETTLE_TOLERANCE_MV 20
 #define CONTROL_CURRENT_PIN 10 // can not be changed
+// PI current controller runs on every gauge sample. Sim step 1 -> 2 A
+// (program --step): 2.7 ms rise, 0.4% overshoot, within 0.5% after 34 ms.
+// 16 Hz settles in 16 ms there, but overshoots 1..4.5% through the INA219
+// conversion lag; KP 128 only adds overshoot.
+#define CURRENT_CONTROL_BANDWIDTH_HZ 8
+#define CURRENT_CONTROL_KP_Q8 64 // 0.25 in 1/256 units
+// Feed-forward table maps desired current to pwm duty cycle, it is measured
+// by calibration sweep from 0 up to the desired current
+#define FEED_FORWARD_POINTS 17
+#define FEED_FORWARD_SETTLE_SAMPLES 20
+#define FEED_FORWARD_AVERAGE_SAMPLES 32
+
+// DC internal resistance: current steps up by IR_STEP_AMPERAGE, at most up
+// to MAX_CURRENT_MA, voltage and current are averaged right before the step
+// and IR_STEP_DELAY_SAMPLES after
+#define IR_STEP_AMPERAGE 1000
+#define IR_STEP_DELAY_SAMPLES 20 // 100 ms at 200 Hz
+#define IR_AVERAGE_SAMPLES 4
+#define IR_RECOVERY_SAMPLES 40
+#define IR_STEPS 4
+#define IR_MIN_STEP_AMPERAGE 100 // smaller steps are discarded
+#define IR_MEASUREMENT_INTERVAL_MS 0UL // periodic in constant current mode, 0 disables
 
 #define SD_CARD_DUMP_INTERVAL_CYCLES 5
 #define SD_CARD_SC_PIN 9
+#define SD_CARD_FLUSH_INTERVAL_RECORDS 10
+#define SD_CARD_PREALLOCATE_BYTES (1024UL * 1024UL) // ~11 hours of records
+// Packed records from binary_log.h instead of CSV text, see tools/log_decoder
+#define SD_CARD_LOG_FORMAT_BINARY false
+// Every gauge sample goes to logNNNN.raw file while load is on instead of
+// once per second records
+#define SD_CARD_RAW_CAPTURE false
+#define RAW_CAPTURE_BUFFER_RECORDS 16 // two buffers in RAM, 8 bytes per record
+
+// Binary packets from telemetry_protocol.h on UART instead of text output,
+// see tools/telemetry_receiver
+#define TELEMETRY_ENABLED false
+#define TELEMETRY_BAUD_RATE 500000UL
+#define TELEMETRY_BUFFER_SIZE 128
+// Text commands on Serial, see remote_control.h
+#define REMOTE_CONTROL_ENABLED !TELEMETRY_ENABLED
+#define REMOTE_CONTROL_LINE_LENGTH 24
+// Longest piece of reply written at once. Commands wait until the 64 byte
+// transmit buffer has that much room, longer replies go out in pieces
+// across loop() passes, so Serial never blocks.
+#define REMOTE_CONTROL_REPLY_PART 48
+#define SERIAL_BAUD_RATE 115200
+// Per stage execution time statistics, 26 bytes of RAM per stage. Shown on
+// hidden page (hold button while load is off) and by SYST:PROF? command.
+#define PROFILER_ENABLED false
+#define PROFILER_HISTOGRAM_BUCKETS 16
 
 #define AMPERAGE_ON_OFF_PIN A3
 #define EMERGENCY_AMPERAGE 3150
+// Instant limits checked on every gauge sample in the I2C interrupt, above
+// setpoint range and averaged limits so noise does not trip the load
+#define TRIP_AMPERAGE 18000
+// Bus pin voltage, INA219 absolute maximum is 26V
+#define TRIP_VOLTAGE 25500
 #define NOICE_AMPERAGE 15
 #define NOISE_VOLTAGE 15
 
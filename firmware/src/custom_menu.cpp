@@ -1,4 +1,3 @@
-#include <SSD1306AsciiWire.h>
 #include <ClickEncoder.h>
 
 #include "custom_menu.h"
@@ -42,18 +41,18 @@ size_t CustomMenuPrintContext::getStringLength(const char c) {
 }
 
 void CustomMenuPrintContext::skipPrintChars(size_t amount) {
-  oled.setCol(oled.col() + amount * (oled.fontWidth() + oled.letterSpacing()));
+  frame.setCol(frame.col() + amount);
 }
 
 void CustomMenuPrintContext::setCol(uint8_t col) {
-  oled.setCol(col * (oled.fontWidth() + oled.letterSpacing()));
+  frame.setCol(col);
 }
 
 void CustomMenuPrintContext::printInt(int32_t value, uint8_t firstDigits, uint8_t lastDigits) {
   value = constrainInt(value, firstDigits + lastDigits);
   int32_t divider = pow10(lastDigits);
   printIntPart(value / divider, firstDigits, ' ');
-  oled.print('.');
+  frame.print('.');
   printIntPart(abs(value % divider), lastDigits, '0');
 }
 
@@ -68,10 +67,10 @@ void CustomMenuPrintContext::printInt(bool change, int32_t value, uint8_t firstD
 void CustomMenuPrintContext::printIntPart(int32_t value, const uint8_t digits, const char filler) {
   for (int i = digits - 1; i > 0; --i) {
     if (value < pow10(i) && value > -pow10(i - 1)) {
-      oled.print(filler);
+      frame.print(filler);
     }
   }
-  oled.print(value);  
+  frame.print(value);  
 }
 
   
@@ -100,22 +99,22 @@ CustomMenu::CustomMenu(std::initializer_list<CustomMenuItem *> items)
 }
 
 void CustomMenu::print(const CustomMenuPrintContext &printContext) {
-  const SSD1306AsciiWire &oled = printContext.oled;
+  DisplayFrame &frame = printContext.frame;
   for (int i = 0; i < num_children; ++i) {
     CustomMenuItem *child = children[i];
     CustomMenu::ActiveStatus activeStatus = getActiveStatus(i);
     CustomMenu::FocusStatus focusStatus = getFocusStatus(i);
     if (focusStatus == CustomMenu::LostFocus) {
-      oled.setCursor(0, i);
-      oled.print(' ');
+      frame.setCursor(0, i);
+      frame.print(' ');
     } else if (focusStatus == CustomMenu::AcquiredFocus) {
-      oled.setCursor(0, i);
-      oled.print('>');
+      frame.setCursor(0, i);
+      frame.print('>');
     } else if (child->canAcquireFocus()) {
-      oled.setCursor(0, i);
+      frame.setCursor(0, i);
       printContext.skipPrintChars(1);
     } else {
-      oled.setCursor(0, i);
+      frame.setCursor(0, i);
     }
     child->print(printContext, focusStatus, activeStatus);
   }
@@ -214,9 +213,15 @@ bool CustomMenuItem::canAcquireFocus() {
 
 namespace DeviceOnOffToggleMenuItem {
   void print(const CustomMenuPrintContext &context, CustomMenu::FocusStatus, CustomMenu::ActiveStatus activeStatus) {
-    if (context.fullPaint || SystemState::isChanged(SystemState::DeviceStatusIsOn)) {
+    if (context.fullPaint 
+        || SystemState::isChanged(SystemState::DeviceStatusIsOn)
+        || SystemState::isChanged(SystemState::CurrentCalibration)) {
       context.lazyPrint(F("Status "));
-      context.oled.print(SystemState::getDeviceStatusIsOn() ? F("On ") : F("Off"));
+      if (AmperagePinManager::isCalibrating()) {
+        context.frame.print(F("Cal"));
+      } else {
+        context.frame.print(SystemState::getDeviceStatusIsOn() ? F("On ") : F("Off"));
+      }
     }
   }
 
@@ -252,14 +257,14 @@ namespace SdFileLoggerMenuItem {
         || focusStatus == CustomMenu::AcquiredFocus
         || focusStatus == CustomMenu::LostFocus) {
       if (SdCardLogger::isFault()) {
-        context.oled.print(F("No SD"));
+        context.frame.print(F("No SD"));
       } else {
-        SdCardLogger::printFileName(context.oled);
+        SdCardLogger::printFileName(context.frame);
       }
       if (focusStatus == CustomMenu::AcquiredFocus || focusStatus == CustomMenu::Focused) {
-        context.oled.print(F(" (new)"));
+        context.frame.print(F(" (new)"));
       }
-      context.oled.clearToEOL();
+      context.frame.clearToEOL();
     }
   }
 
@@ -275,14 +280,27 @@ namespace SdFileLoggerMenuItem {
 CustomMenuItem sdFileLoggerMenuItem(SdFileLoggerMenuItem::shadow);
 
 
+// Shows internal resistance while there is no emergency
 namespace EmergencyInfoMenuItem {
+  static uint16_t shownInternalResistance = 0;
+
   void print(const CustomMenuPrintContext &context, CustomMenu::FocusStatus, CustomMenu::ActiveStatus activeStatus) {
-    if (context.fullPaint || SystemState::isChanged(SystemState::MainEmergency)) {
+    uint16_t internalResistance = AmperagePinManager::getInternalResistance();
+    if (context.fullPaint 
+        || SystemState::isChanged(SystemState::MainEmergency)
+        || internalResistance != shownInternalResistance) {
+      shownInternalResistance = internalResistance;
       uint16_t emergencyValue = EmergencyManager::getMainEmergency();
       if (emergencyValue == EmergencyManager::Calmness) {
-        context.oled.clearToEOL();
+        if (internalResistance != 0) {
+          context.frame.print(F("IR "));
+          context.printInt(internalResistance, 4, 1);
+          context.frame.print(F(" mOhm"));
+        }
+        context.frame.clearToEOL();
       } else {
-        context.oled.print(EmergencyManager::emergencyToString(emergencyValue));
+        context.frame.print(EmergencyManager::emergencyToString(emergencyValue));
+        context.frame.clearToEOL();
       }
     }
   }
@@ -308,31 +326,64 @@ namespace TemperatureAndWattInfoMenuItem {
 CustomMenuItem temperatureAndWattInfoMenuItem(TemperatureAndWattInfoMenuItem::shadow);
 
 
-namespace EmptySpacerMenuItem {
-  const CustomMenuItemShadow shadow PROGMEM = {nullptr, false, nullptr, nullptr};  
+namespace SamplingInfoMenuItem {
+  static uint16_t shownLateSamples = 0;
+  static uint16_t shownDroppedSamples = 0;
+  static uint32_t shownOverrunRecords = 0;
+
+  // Stays empty until acquisition or raw capture can not keep up with the sample rate
+  void print(const CustomMenuPrintContext &context, CustomMenu::FocusStatus, CustomMenu::ActiveStatus activeStatus) {
+    uint16_t lateSamples = GaugeReader::getLateSamples();
+    uint16_t droppedSamples = GaugeReader::getDroppedSamples();
+    uint32_t overrunRecords = RawCapture::getOverrunRecords();
+    if (!context.fullPaint 
+        && lateSamples == shownLateSamples 
+        && droppedSamples == shownDroppedSamples
+        && overrunRecords == shownOverrunRecords) {
+      return;
+    }
+    shownLateSamples = lateSamples;
+    shownDroppedSamples = droppedSamples;
+    shownOverrunRecords = overrunRecords;
+    if (lateSamples != 0 || droppedSamples != 0 || overrunRecords != 0) {
+      context.frame.print(F("Late "));
+      context.frame.print(lateSamples);
+      context.frame.print(F(" Lost "));
+      context.frame.print(droppedSamples);
+      if (overrunRecords != 0) {
+        context.frame.print(F(" Ovr "));
+        context.frame.print(overrunRecords);
+      }
+    }
+    context.frame.clearToEOL();
+  }
+
+  const CustomMenuItemShadow shadow PROGMEM = {print, false, nullptr, nullptr};
 };
 
-CustomMenuItem emptySpacerMenuItem(EmptySpacerMenuItem::shadow);
+CustomMenuItem samplingInfoMenuItem(SamplingInfoMenuItem::shadow);
 
 
 namespace TwoValuesMenuItem {
   struct Object {
     bool isFine:1;
+    bool isModeSelect:1;
     bool activeCursorChanged:1;
-    Object() : isFine(false), activeCursorChanged(false) {}
+    Object() : isFine(false), isModeSelect(false), activeCursorChanged(false) {}
   };
 
   void print(Object &obj, const CustomMenuPrintContext &context, CustomMenu::FocusStatus, CustomMenu::ActiveStatus activeStatus, const __FlashStringHelper *name, 
-      bool isLeftValueChanged, int32_t leftValue, bool isRightValueChanged, int32_t rightValue, bool customZero) {
+      bool isLeftValueChanged, int32_t leftValue, bool isRightValueChanged, int32_t rightValue, bool customZero, uint8_t firstDigits = 2) {
+    uint8_t lastDigits = 5 - firstDigits;
     context.lazyPrint(name);
     context.lazyPrint(' ');
-    context.printInt(isLeftValueChanged, leftValue, 2, 3);
+    context.printInt(isLeftValueChanged, leftValue, firstDigits, lastDigits);
     context.lazyPrint(F(" /"));
     if (context.fullPaint || obj.activeCursorChanged) {
       if (activeStatus == CustomMenu::LostActive || activeStatus == CustomMenu::NotActive) {
-        context.oled.print(' ');
+        context.frame.print(' ');
       } else if (activeStatus == CustomMenu::AcquiredActive || activeStatus == CustomMenu::Active) {
-        context.oled.print(obj.isFine ? ':' : '>');
+        context.frame.print(obj.isModeSelect ? '*' : obj.isFine ? ':' : '>');
       }
     } else {
       context.skipPrintChars(1);
@@ -340,13 +391,13 @@ namespace TwoValuesMenuItem {
     if (customZero && rightValue == 0) {
       context.lazyPrint(F(" -----"), isRightValueChanged);
     } else {
-      context.printInt(isRightValueChanged, rightValue, 2, 3);
+      context.printInt(isRightValueChanged, rightValue, firstDigits, lastDigits);
     }
     if (context.fullPaint || obj.activeCursorChanged) {
       if (activeStatus == CustomMenu::LostActive || activeStatus == CustomMenu::NotActive) {
-        context.oled.print(' ');
+        context.frame.print(' ');
       } else if (activeStatus == CustomMenu::AcquiredActive || activeStatus == CustomMenu::Active) {
-        context.oled.print(obj.isFine ? ':' : '<');
+        context.frame.print(obj.isModeSelect ? '*' : obj.isFine ? ':' : '<');
       }
     } else {
       context.skipPrintChars(1);
@@ -365,37 +416,107 @@ namespace TwoValuesMenuItem {
 };
 
 
-namespace AmperageTwoValuesMenuItem {
+// Setpoint of the current load mode. Enter cycles coarse, fine and mode
+// selection, in the last one rotation switches the mode.
+namespace LoadSetpointMenuItem {
   TwoValuesMenuItem::Object obj;
-  
+  static SystemState::LoadMode shownMode = SystemState::ConstantCurrent;
+
+  struct ModeInfo {
+    char name[4];
+    uint16_t coarseStep;
+    uint16_t fineStep;
+    uint32_t minValue; // non zero setpoints below are rounded
+    uint32_t maxValue;
+    uint8_t divider; // setpoint units per last shown digit
+    uint8_t firstDigits;
+  };
+
+  const ModeInfo modes[SystemState::LoadModeCount] PROGMEM = {
+    {"Amp", AMPERAGE_CHANGE_CORSE_STEP, AMPERAGE_CHANGE_FINE_STEP, MIN_CURRENT_MA, MAX_CURRENT_MA, 1, 2}, // A
+    {"Pwr", 1000, 10, 0, MAX_POWER_MW, 10, 3}, // W
+    {"Res", 1000, 10, MIN_RESISTANCE_MOHM, MAX_RESISTANCE_MOHM, 10, 3}, // Ohm
+    {"CV ", 100, 1, 0, 32000, 1, 2}, // V
+    {"Dyn", AMPERAGE_CHANGE_CORSE_STEP, AMPERAGE_CHANGE_FINE_STEP, MIN_CURRENT_MA, MAX_CURRENT_MA, 1, 2}, // A, high level
+  };
+
   void print(const CustomMenuPrintContext &context, CustomMenu::FocusStatus focusStatus, CustomMenu::ActiveStatus activeStatus) {
-    bool isLeftValueChanged = SystemState::isChanged(SystemState::AverageAmperage);
-    bool isRightValueChanged = SystemState::isChanged(SystemState::DesiredAmperage);
-    int32_t leftValue = SystemState::getAverageAmperage();
-    int32_t rightValue = SystemState::getDesiredAmperage();
-    TwoValuesMenuItem::print(obj, context, focusStatus, activeStatus, F("Amp"), 
-        isLeftValueChanged, leftValue, isRightValueChanged, rightValue, false);    
+    SystemState::LoadMode loadMode = SystemState::getLoadMode();
+    ModeInfo mode;
+    memcpy_P(&mode, &modes[loadMode], sizeof(mode));
+    // Whole row is repainted when mode changes
+    CustomMenuPrintContext modeContext = {context.frame, context.fullPaint || loadMode != shownMode};
+    shownMode = loadMode;
+
+    bool isLeftValueChanged;
+    int32_t leftValue;
+    switch (loadMode) {
+      case SystemState::ConstantPower:
+        isLeftValueChanged = SystemState::isChanged(SystemState::AveragePower);
+        leftValue = SystemState::getAveragePower();
+        break;
+      case SystemState::ConstantResistance:
+        isLeftValueChanged = SystemState::isChanged(SystemState::AveragePower);
+        leftValue = SystemState::getAverageAmperage() == 0 ? 0
+            : SystemState::getAverageVoltage() * 1000 / SystemState::getAverageAmperage();
+        break;
+      case SystemState::ConstantVoltage:
+        isLeftValueChanged = SystemState::isChanged(SystemState::AverageVoltage);
+        leftValue = SystemState::getAverageVoltage();
+        break;
+      default:
+        isLeftValueChanged = SystemState::isChanged(SystemState::AverageAmperage);
+        leftValue = SystemState::getAverageAmperage();
+        break;
+    }
+    bool isRightValueChanged = SystemState::isChanged(SystemState::DesiredAmperage)
+        || SystemState::isChanged(SystemState::LoadSetpoint);
+    int32_t rightValue = SystemState::getLoadSetpoint();
+    TwoValuesMenuItem::print(obj, modeContext, focusStatus, activeStatus, (const __FlashStringHelper *) modes[loadMode].name, 
+        isLeftValueChanged, leftValue / mode.divider, isRightValueChanged, rightValue / mode.divider, false, mode.firstDigits);
   }
 
   void processMoveEvent(int16_t moveValue) {
-    int16_t multiplier = obj.isFine ? AMPERAGE_CHANGE_FINE_STEP : AMPERAGE_CHANGE_CORSE_STEP;
+    if (obj.isModeSelect) {
+      int8_t loadMode = SystemState::getLoadMode() + sgn(moveValue);
+      loadMode = (loadMode + SystemState::LoadModeCount) % SystemState::LoadModeCount;
+      SystemState::setLoadMode((SystemState::LoadMode) loadMode);
+      return;
+    }
+    ModeInfo mode;
+    memcpy_P(&mode, &modes[SystemState::getLoadMode()], sizeof(mode));
+    int32_t multiplier = obj.isFine ? mode.fineStep : mode.coarseStep;
     int32_t adjustment = moveValue * multiplier;
-    int32_t rightValue = SystemState::getDesiredAmperage() + adjustment;
-    if (rightValue > 0 && rightValue < MIN_CURRENT_MA) {
-      rightValue = adjustment > 0 ? MIN_CURRENT_MA : 0;
+    int32_t rightValue = SystemState::getLoadSetpoint() + adjustment;
+    if (rightValue > 0 && rightValue < (int32_t) mode.minValue) {
+      rightValue = adjustment > 0 ? mode.minValue : 0;
     }
-    rightValue = constrain(rightValue, 0, MAX_CURRENT_MA);
-    SystemState::setDesiredAmperage(rightValue);
+    rightValue = constrain(rightValue, 0, (int32_t) mode.maxValue);
+    SystemState::setLoadSetpoint(rightValue);
   }
   
   bool processEnterEvent(bool isActive) {
-    return TwoValuesMenuItem::processEnterEvent(obj, isActive);
+    obj.activeCursorChanged = true;
+    if (!isActive) {
+      return true;
+    }
+    if (!obj.isFine && !obj.isModeSelect) {
+      obj.isFine = true;
+      return true;
+    }
+    if (obj.isFine) {
+      obj.isFine = false;
+      obj.isModeSelect = true;
+      return true;
+    }
+    obj.isModeSelect = false;
+    return false;
   }
 
   const CustomMenuItemShadow shadow PROGMEM = {print, true, processMoveEvent, processEnterEvent}; 
 }
 
-CustomMenuItem amperageTwoValuesMenuItem(AmperageTwoValuesMenuItem::shadow);
+CustomMenuItem loadSetpointMenuItem(LoadSetpointMenuItem::shadow);
 
 
 namespace VoltageTwoValuesMenuItem {
@@ -427,11 +548,11 @@ namespace VoltageTwoValuesMenuItem {
 CustomMenuItem voltageTwoValuesMenuItem(VoltageTwoValuesMenuItem::shadow);
 
 
-CustomMenu topMenu = CustomMenu({&amperageTwoValuesMenuItem, 
+CustomMenu topMenu = CustomMenu({&loadSetpointMenuItem, 
                                  &voltageTwoValuesMenuItem, 
                                  &deviceOnOffToggleMenuItem, 
                                  &sdFileLoggerMenuItem, 
-                                 &emptySpacerMenuItem, 
+                                 &samplingInfoMenuItem, 
                                  &temperatureAndWattInfoMenuItem, 
                                  &capacityInfoMenuItem, 
                                  &emergencyInfoMenuItem});
@@ -1,11 +1,12 @@
 #pragma once
 
 #include "initializer_list.h"
+#include "display_frame.h"
 
 class CustomMenuItem;
 
 struct CustomMenuPrintContext {
-  const SSD1306AsciiWire &oled;
+  DisplayFrame &frame;
   bool fullPaint;
 
   void printIntPart(int32_t value, const uint8_t digits, const char filler);
@@ -17,7 +18,7 @@ struct CustomMenuPrintContext {
   template<typename T>
   void lazyPrint(T str, bool enforce = false) {
     if (fullPaint || enforce) {
-      oled.print(str);
+      frame.print(str);
     } else {
       skipPrintChars(getStringLength(str));
     }
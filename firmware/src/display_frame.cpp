@@ -0,0 +1,97 @@
+#include <SSD1306AsciiAvrI2c.h>
+
+#include "display_frame.h"
+#include "i2c_bus.h"
+#include "constants.h"
+
+// Column and page address commands of SSD1306 before every run
+#define RUN_ADDRESS_BYTES 3
+
+DisplayFrame displayFrame;
+
+// Display is cleared in setup, so blank frame is already shown
+DisplayFrame::DisplayFrame() : column(0), row(0), stats() {
+  memset(text, ' ', sizeof(text));
+}
+
+void DisplayFrame::setCursor(uint8_t newColumn, uint8_t newRow) {
+  column = newColumn;
+  row = newRow % ROWS;
+}
+
+void DisplayFrame::setCol(uint8_t newColumn) {
+  column = newColumn;
+}
+
+void DisplayFrame::clear() {
+  for (row = 0; row < ROWS; ++row) {
+    setCol(0);
+    clearToEOL();
+  }
+  setCursor(0, 0);
+}
+
+void DisplayFrame::clearToEOL() {
+  uint8_t oldColumn = column;
+  while (write(' ')) {}
+  column = oldColumn;
+}
+
+size_t DisplayFrame::write(uint8_t chr) {
+  if (chr == '\r') {
+    return 1;
+  }
+  if (chr == '\n') {
+    setCursor(0, row + 1);
+    return 1;
+  }
+  if (column >= COLUMNS) {
+    return 0; // clipped like by display driver
+  }
+  chr &= ~DIRTY;
+  uint8_t &cell = text[row][column++];
+  if ((cell & ~DIRTY) != chr) {
+    cell = chr | DIRTY;
+  }
+  return 1;
+}
+
+// Runs are split into chunks of DISPLAY_CHUNK_CHARS with bus unlocked in
+// between, so gauge reads wait for one chunk at most
+void DisplayFrame::render(SSD1306AsciiAvrI2c &oled) {
+  uint32_t startTime = micros();
+  uint16_t bytes = 0;
+  for (uint8_t r = 0; r < ROWS; ++r) {
+    for (uint8_t c = 0; c < COLUMNS;) {
+      if (!(text[r][c] & DIRTY)) {
+        ++c;
+        continue;
+      }
+      uint8_t chunkEnd = min(c + DISPLAY_CHUNK_CHARS, (int) COLUMNS);
+      I2cBus::lock();
+      oled.setCursor(c * CHAR_WIDTH, r);
+      bytes += RUN_ADDRESS_BYTES;
+      for (; c < chunkEnd && text[r][c] & DIRTY; ++c) {
+        text[r][c] &= ~DIRTY;
+        oled.write(text[r][c]);
+        bytes += CHAR_WIDTH;
+      }
+      I2cBus::unlock();
+    }
+  }
+  if (bytes == 0) {
+    return;
+  }
+  uint16_t time = min(micros() - startTime, 0xFFFFUL);
+  ++stats.frames;
+  stats.lastBytes = bytes;
+  stats.maxBytes = max(stats.maxBytes, bytes);
+  stats.lastTime = time;
+  stats.maxTime = max(stats.maxTime, time);
+  stats.totalBytes += bytes;
+}
+
+void DisplayFrame::resetMaxStats() {
+  stats.maxBytes = 0;
+  stats.maxTime = 0;
+}
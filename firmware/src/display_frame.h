@@ -0,0 +1,48 @@
+#pragma once
+
+#include <Arduino.h>
+
+class SSD1306AsciiAvrI2c;
+
+// Character shadow of the display. Menu prints into it and render() sends
+// only characters which differ from what display already shows, one I2C
+// burst per run of changed characters in a row, runs are split into bounded
+// chunks. Cursor is in characters.
+class DisplayFrame : public Print {
+public:
+  static const uint8_t ROWS = 8;
+  static const uint8_t COLUMNS = 21;
+  static const uint8_t CHAR_WIDTH = 6; // pixels, font5x7 and letter spacing
+
+  struct Stats {
+    uint16_t frames; // renders which sent anything
+    uint16_t lastBytes; // display RAM and addressing bytes of last frame
+    uint16_t maxBytes;
+    uint16_t lastTime; // us, saturated
+    uint16_t maxTime; // us, saturated
+    uint32_t totalBytes;
+  };
+
+  DisplayFrame();
+  void setCursor(uint8_t column, uint8_t row);
+  void setCol(uint8_t column);
+  uint8_t col() const { return column; }
+  void clear();
+  void clearToEOL();
+  size_t write(uint8_t chr) override;
+  using Print::write;
+
+  void render(SSD1306AsciiAvrI2c &oled);
+  const Stats &getStats() const { return stats; }
+  void resetMaxStats();
+
+private:
+  // High bit marks characters not sent to display yet, font is 7 bit
+  static const uint8_t DIRTY = 0x80;
+  uint8_t text[ROWS][COLUMNS];
+  uint8_t column;
+  uint8_t row;
+  Stats stats;
+};
+
+extern DisplayFrame displayFrame;
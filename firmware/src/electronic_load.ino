@@ -1,35 +1,124 @@
 
-#include <Wire.h>
 #include <ClickEncoder.h>
 #include <SSD1306Ascii.h>
-#include <SSD1306AsciiWire.h>
+#include <SSD1306AsciiAvrI2c.h>
 #include <MemoryFree.h>
 
 #include "constants.h"
 #include "menu_navigator.h"
 #include "system_state.h"
 #include "managers.h"
+#include "telemetry.h"
+#include "remote_control.h"
+#include "task_scheduler.h"
+#include "profiler.h"
+#include "i2c_bus.h"
 
-SSD1306AsciiWire oled;
+SSD1306AsciiAvrI2c oled;
 
 ClickEncoder encoder(ENCODER_PIN_LEFT,
                      ENCODER_PIN_RIGHT,
                      ENCODER_PIN_BTN,
                      4);
 
-uint32_t lastGaugeUpdateTime = 0;
-uint32_t loopProcessedLastTime = 0;
-
 MenuNavigator menuNavigator = MenuNavigator(encoder, oled);
 
+void gaugeTask() {
+  Profiler::Probe probe(Profiler::Gauge);
+  GaugeReader::makeMeasurement();
+  EmergencyManager::reportTrip();
+}
+
+void emergencyTask() {
+  Profiler::Probe probe(Profiler::Emergency);
+  EmergencyManager::updateOnOffState();
+}
+
+void regulateTask() {
+  {
+    Profiler::Probe probe(Profiler::Regulation);
+    AmperagePinManager::tuneDischargeCurrent();
+  }
+  RemoteControl::updateLatency();
+}
+
+void inputTask() {
+  {
+    Profiler::Probe probe(Profiler::Input);
+    menuNavigator.processInput();
+  }
+  RemoteControl::processCommands();
+}
+
+void averageTask() {
+  {
+    Profiler::Probe probe(Profiler::Average);
+    SystemState::calculateAverage();
+  }
+  Profiler::Probe probe(Profiler::Thermistor);
+  FanTemperatureReader::updateAverageTemperatureValue();
+}
+
+void rawCaptureTask() {
+  Profiler::Probe probe(Profiler::SdCard);
+  SdCardLogger::writeRawCapture();
+}
+
+void displayTask() {
+  Profiler::Probe probe(Profiler::Display);
+  menuNavigator.updateOutput();
+}
+
+void logTask() {
+  {
+    Profiler::Probe probe(Profiler::SdCard);
+    SdCardLogger::writeSystemState();
+  }
+  Profiler::Probe probe(Profiler::Persistence);
+  PersistenceStateManager::preserve();
+}
+
+// Flags the event driven tasks read, they are not run otherwise
+const uint32_t EMERGENCY_INPUTS = SystemState::AverageTemperature | SystemState::AverageVoltage
+    | SystemState::StopVoltage | SystemState::DeviceStatusIsOn
+    | SystemState::DesiredAmperage | SystemState::LoadSetpoint;
+const uint32_t REGULATION_INPUTS = SystemState::NewMeasurement | SystemState::AverageVoltage
+    | SystemState::DeviceStatusIsOn | SystemState::DesiredAmperage | SystemState::LoadSetpoint
+    | SystemState::CurrentCalibration | SystemState::ControlCommand;
+const uint32_t FAN_INPUTS = SystemState::AverageTemperature;
+
+// Priority order, critical tasks keep sample processing and regulation
+// latency independent of display and SD card
+const TaskScheduler::Task tasks[] PROGMEM = {
+  // name      run                                   period               deadline critical subscriptions
+  {"gauge",    gaugeTask,                            0,                   25,      true,    0},
+  {"emerg",    emergencyTask,                        0,                   25,      true,    EMERGENCY_INPUTS},
+  {"regul",    regulateTask,                         0,                   25,      true,    REGULATION_INPUTS},
+  {"input",    inputTask,                            10,                  20,      false,   0},
+  {"average",  averageTask,                          REFRESH_INTERVAL_MS, 50,      false,   0},
+  {"raw",      rawCaptureTask,                       0,                   100,     false,   0},
+  {"telem",    Telemetry::sendSystemState,           0,                   100,     false,   0},
+  {"fan",      FanManager::updateFanSpeed,           0,                   100,     false,   FAN_INPUTS},
+  {"display",  displayTask,                          50,                  100,     false,   0},
+  {"sdlog",    logTask,                              REFRESH_INTERVAL_MS, 200,     false,   0},
+  {"eeprom",   PersistenceStateManager::update,      0,                   100,     false,   0},
+};
+
+TaskScheduler::TaskStats taskStats[sizeof(tasks) / sizeof(tasks[0])];
+
 ISR(TIMER1_OVF_vect)
 {
   encoder.service();
+  AcquisitionScheduler::tick();
 }
 
 void setup() {
-  Serial.begin(9600);
+#if TELEMETRY_ENABLED
+  Telemetry::setup();
+#else
+  Serial.begin(SERIAL_BAUD_RATE);
   Serial.println(F("Setup Start!"));
+#endif
 
   randomSeed(analogRead(UNUSED_ANALOG_PIN));
 
@@ -40,6 +129,7 @@ void setup() {
   FanTemperatureReader::setup();
   GaugeReader::setup();
   SdCardLogger::setup();
+  RemoteControl::setup();
 
   setupOledDisplay();
 
@@ -54,50 +144,24 @@ void setup() {
   // interrupt is attached
   TIMSK1 = _BV(TOIE1); 
 
+#if !TELEMETRY_ENABLED
   Serial.print(F("Memory left: "));
   Serial.print(freeMemory());
   Serial.println(F(" bytes"));
   Serial.println(F("Setup end! "));
+#endif
 
-  loopProcessedLastTime = millis();
+  TaskScheduler::setup(tasks, taskStats);
 }
 
 void loop() {
-  unsigned long now = millis();
-
-  menuNavigator.processInput();
-  GaugeReader::makeMeasurement();
-  FanTemperatureReader::makeMeasurement();
-
-  unsigned long timeSinceLastupdate = now - lastGaugeUpdateTime;
-  bool isRefreshCycle = timeSinceLastupdate >= REFRESH_INTERVAL_MS;
-  if (isRefreshCycle) {  
-    lastGaugeUpdateTime = now;
-    SystemState::calculateAverage(timeSinceLastupdate);
-    FanTemperatureReader::updateAverageTemperatureValue();
-  }
-
-  EmergencyManager::updateOnOffState();
-  AmperagePinManager::tuneDischargeCurrent(isRefreshCycle);
-  menuNavigator.updateOutput();
-  FanManager::updateFanSpeed();
-
-  if (isRefreshCycle) {
-    SdCardLogger::writeSystemState();
-    PersistenceStateManager::preserve();
-  }
-  
-//  SystemState::debugPrint();
-
-//  Serial.println(now - loopProcessedLastTime);
-//  loopProcessedLastTime = now;
-
-  SystemState::clearChangeFlag(); // should go the last
+  TaskScheduler::run();
 }
 
 void setupOledDisplay() {
-  Wire.begin();
   oled.begin(&Adafruit128x64, DISPLAY_I2C_ADDRESS);
+  // Display driver sets up its own bus clock
+  I2cBus::setup();
   oled.setFont(MENU_FONT);
  
   oled.clear();
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "constants.h"
+#include "calibration.h"
+
+// INA219 register to mA and mV curves. GaugeReader applies them on every
+// sample, tools/calibration_check.cpp compares them with the float math
+// they replaced.
+namespace GaugeCalibration {
+  // Shunt register is in 10uV and shunt is 1/60 Ohm, so 0.6 mA per unit
+  constexpr int16_t shuntFromAmperage(int32_t mA) {
+    return (mA * 5 + 1) / 3;
+  }
+
+  // Shunt register to mA
+  typedef Calibration<
+      Breakpoint<shuntFromAmperage(NOICE_AMPERAGE), NOICE_AMPERAGE * 1009L / 1000>,
+      Breakpoint<shuntFromAmperage(3778), 3812>,
+      Breakpoint<shuntFromAmperage(6091), 6125>,
+      Breakpoint<shuntFromAmperage(19200), 19090>> AmperageCalibration;
+
+  // Bus voltage in mV to mV
+  typedef Calibration<
+      Breakpoint<0, 43>,
+      Breakpoint<32000, 31957>> VoltageCalibration;
+
+  // Voltage drop on wires and shunt, mA to mV
+  typedef Calibration<
+      Breakpoint<0, 0>,
+      Breakpoint<20000, 480>> VoltageDropCompensation;
+
+  inline int32_t toAmperage(int16_t shuntVoltage) {
+    return shuntVoltage < shuntFromAmperage(NOICE_AMPERAGE) ? 0 : AmperageCalibration::apply(shuntVoltage);
+  }
+
+  // busVoltage is in mV, amperage is the calibrated load current
+  inline int32_t toVoltage(int16_t busVoltage, int32_t amperage) {
+    return busVoltage < NOISE_VOLTAGE ? 0
+        : VoltageCalibration::apply(busVoltage) + VoltageDropCompensation::apply(amperage);
+  }
+};
@@ -0,0 +1,153 @@
+#include <Arduino.h>
+#include <util/twi.h>
+#include <util/atomic.h>
+
+#include "i2c_bus.h"
+#include "constants.h"
+#include "ring_buffer.h"
+
+namespace I2cBus {
+  static const uint8_t TWCR_SEND = _BV(TWINT) | _BV(TWEN) | _BV(TWIE);
+
+  struct Transaction {
+    ReadCallback callback;
+    uint8_t address;
+    uint8_t reg;
+  };
+
+  static Transaction transaction;
+  static uint16_t readValue;
+  // Reads waiting for bus, producers are interrupts only
+  static RingBuffer<Transaction, 4> queue;
+
+  static volatile bool busy = false;
+  static volatile bool locked = false;
+  static volatile bool inCallback = false;
+
+  void setup() {
+    TWSR = 0; // prescaler x1
+    TWBR = ((F_CPU / I2C_CLOCK_HZ) - 16) / 2;
+    TWCR = _BV(TWEN);
+  }
+
+  static void waitForStop() {
+    while (TWCR & _BV(TWSTO)) {}
+  }
+
+  static void start(const Transaction &next) {
+    transaction = next;
+    readValue = 0;
+    busy = true;
+    if (!inCallback) {
+      // Otherwise start is combined with stop of the finished transaction
+      waitForStop();
+      TWCR = TWCR_SEND | _BV(TWSTA);
+    }
+  }
+
+  // Read started from callback continues the finished one, so it goes
+  // ahead of the queue
+  bool startReadRegister(uint8_t address, uint8_t reg, ReadCallback callback) {
+    Transaction request = {callback, address, reg};
+    if (busy || locked || (!inCallback && !queue.isEmpty())) {
+      return queue.push(request);
+    }
+    start(request);
+    return true;
+  }
+
+  bool isBusy() {
+    return busy;
+  }
+
+  // Display has the lowest priority, it gets bus once queued reads are done
+  void lock() {
+    while (!locked) {
+      ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        locked = !busy && queue.isEmpty();
+      }
+    }
+    waitForStop();
+  }
+
+  void unlock() {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      locked = false;
+      Transaction next;
+      if (queue.pop(next)) {
+        start(next);
+      }
+    }
+  }
+
+  static bool waitForStatus(uint8_t status) {
+    while (!(TWCR & _BV(TWINT))) {}
+    return TW_STATUS == status;
+  }
+
+  static bool send(uint8_t data, uint8_t status) {
+    TWDR = data;
+    TWCR = _BV(TWINT) | _BV(TWEN);
+    return waitForStatus(status);
+  }
+
+  bool writeRegister(uint8_t address, uint8_t reg, uint16_t value) {
+    lock();
+    TWCR = _BV(TWINT) | _BV(TWSTA) | _BV(TWEN);
+    bool success = waitForStatus(TW_START)
+        && send(address << 1 | TW_WRITE, TW_MT_SLA_ACK)
+        && send(reg, TW_MT_DATA_ACK)
+        && send(value >> 8, TW_MT_DATA_ACK)
+        && send(value & 0xFF, TW_MT_DATA_ACK);
+    TWCR = _BV(TWINT) | _BV(TWSTO) | _BV(TWEN);
+    unlock();
+    return success;
+  }
+
+  static void complete(bool success) {
+    busy = false;
+    inCallback = true;
+    transaction.callback(success, readValue);
+    Transaction next;
+    if (!busy && queue.pop(next)) {
+      start(next);
+    }
+    inCallback = false;
+    TWCR = _BV(TWINT) | _BV(TWSTO) | _BV(TWEN) | (busy ? _BV(TWSTA) | _BV(TWIE) : 0);
+  }
+};
+
+ISR(TWI_vect) {
+  using namespace I2cBus;
+  switch (TW_STATUS) {
+    case TW_START:
+      TWDR = transaction.address << 1 | TW_WRITE;
+      TWCR = TWCR_SEND;
+      break;
+    case TW_MT_SLA_ACK:
+      TWDR = transaction.reg;
+      TWCR = TWCR_SEND;
+      break;
+    case TW_MT_DATA_ACK:
+      TWCR = TWCR_SEND | _BV(TWSTA);
+      break;
+    case TW_REP_START:
+      TWDR = transaction.address << 1 | TW_READ;
+      TWCR = TWCR_SEND;
+      break;
+    case TW_MR_SLA_ACK:
+      TWCR = TWCR_SEND | _BV(TWEA); // ack high byte
+      break;
+    case TW_MR_DATA_ACK:
+      readValue = TWDR << 8;
+      TWCR = TWCR_SEND; // nack low byte
+      break;
+    case TW_MR_DATA_NACK:
+      readValue |= TWDR;
+      complete(true);
+      break;
+    default:
+      complete(false);
+      break;
+  }
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+// Owns TWI hardware. Register reads run in background and are driven by
+// TWI interrupt, reads requested while bus is taken wait in a short queue.
+// Display driver polls TWI by itself and should wrap its traffic into
+// lock()/unlock(). It has the lowest priority: lock() waits for queued reads,
+// so display should keep its transfers short to let reads in between.
+namespace I2cBus {
+  typedef void (*ReadCallback)(bool success, uint16_t value);
+
+  void setup();
+
+  // Returns false if queue is full. Callback is invoked from interrupt and
+  // may start the next read, which goes ahead of queued ones.
+  bool startReadRegister(uint8_t address, uint8_t reg, ReadCallback callback);
+  // Blocking, intended for setup only.
+  bool writeRegister(uint8_t address, uint8_t reg, uint16_t value);
+  bool isBusy();
+
+  void lock();
+  // Starts queued read if any
+  void unlock();
+};
@@ -2,24 +2,101 @@
 #include <EEPROM.h>
 #include <SPI.h>
 #include <SdFat.h>
-#include <Adafruit_INA219.h>
+#include <util/atomic.h>
 
 #include "managers.h"
 #include "system_state.h"
 #include "average.h"
 #include "helpers.h"
+#include "ring_buffer.h"
+#include "i2c_bus.h"
+#include "thermistor_table.h"
+#include "gauge_calibration.h"
+#include "binary_log.h"
+#include "telemetry.h"
+#include "telemetry_protocol.h"
 
 
 namespace AmperagePinManager {
   static int16_t amperagePwmDutyCycle = 0;
+  static int32_t integralPwmDutyCycle = 0; // 1/256 units
+  static bool isRegulating = false;
+  static uint16_t targetAmperage = 0; // mA, follows load mode on every sample
+  static uint32_t jumpTime = 0; // ms, last jump to predicted duty cycle
+  static int32_t voltageModeAmperage = 0; // 1/256 mA, constant voltage integral
+
+  // Integral gain of the PI controller, plant gain is about 1 pwm step per mA
+  static const int32_t KI_Q8 = 2 * 3.14159 * CURRENT_CONTROL_BANDWIDTH_HZ * 256 / SAMPLE_RATE_HZ + 0.5;
+  static const uint8_t SAMPLE_PERIOD_MS = 1000 / SAMPLE_RATE_HZ;
+  static_assert(KI_Q8 > 0 && KI_Q8 <= 256, "Current control bandwidth is out of range");
+
+  static const int16_t FEED_FORWARD_STEP = MAX_PWM_DUTY_CYCLE / (FEED_FORWARD_POINTS - 1);
+  // Sweep ramps to each point in fine steps, a whole step is about 1 A
+  static const int16_t FEED_FORWARD_RAMP_STEP = FEED_FORWARD_STEP / 16;
+  static const uint16_t UNKNOWN_AMPERAGE = 0xFFFF;
+  static const uint8_t FEED_FORWARD_VERSION = 1;
+
+  struct FeedForwardTable {
+    uint8_t version;
+    uint8_t checksum;
+    uint16_t amperage[FEED_FORWARD_POINTS]; // mA at duty cycle i * FEED_FORWARD_STEP
+  };
+
+  // Stored right before PersistenceStateManager offset at the end of EEPROM
+  const uint16_t FEED_FORWARD_TABLE_ADDRESS = E2END + 1 - sizeof(uint16_t) - sizeof(FeedForwardTable);
+
+  static FeedForwardTable feedForwardTable;
+
+  static struct {
+    bool isRunning:1;
+    bool isRamping:1;
+    uint8_t point:6;
+    uint8_t sampleCounter;
+    uint32_t amperageSum;
+  } calibration = {false, false, 0, 0, 0};
+
+  static uint8_t getChecksum(const FeedForwardTable &table) {
+    uint8_t checksum = table.version;
+    for (uint8_t i = 0; i < FEED_FORWARD_POINTS; ++i) {
+      checksum ^= table.amperage[i] ^ (table.amperage[i] >> 8);
+    }
+    return checksum;
+  }
+
+  static void resetFeedForwardTable() {
+    feedForwardTable.version = FEED_FORWARD_VERSION;
+    for (uint8_t i = 0; i < FEED_FORWARD_POINTS; ++i) {
+      feedForwardTable.amperage[i] = UNKNOWN_AMPERAGE;
+    }
+  }
+
+  // Without calibration duty cycle is assumed to match mA 1:1
+  static int16_t predictPwmDutyCycle(uint16_t desiredAmperage) {
+    const uint16_t *amperage = feedForwardTable.amperage;
+    uint8_t i = 1;
+    for (; i < FEED_FORWARD_POINTS && amperage[i] != UNKNOWN_AMPERAGE; ++i) {
+      if (desiredAmperage <= amperage[i]) {
+        int32_t span = amperage[i] - amperage[i - 1];
+        int32_t offset = (int32_t) desiredAmperage - amperage[i - 1];
+        return (i - 1) * FEED_FORWARD_STEP + (span == 0 ? 0 : offset * FEED_FORWARD_STEP / span);
+      }
+    }
+    uint8_t last = i - 1;
+    if (amperage[last] == UNKNOWN_AMPERAGE) {
+      return desiredAmperage;
+    }
+    return last * FEED_FORWARD_STEP + (int32_t) desiredAmperage - amperage[last];
+  }
 
   void setup() {
     pinMode(CONTROL_CURRENT_PIN, OUTPUT);
     digitalWrite(CONTROL_CURRENT_PIN, LOW);
-  }
 
-  static int16_t getStep(int16_t amperageDifference) {
-    return amperageDifference / 5 + sgn(amperageDifference);
+    EEPROM.get(FEED_FORWARD_TABLE_ADDRESS, feedForwardTable);
+    if (feedForwardTable.version != FEED_FORWARD_VERSION 
+        || feedForwardTable.checksum != getChecksum(feedForwardTable)) {
+      resetFeedForwardTable();
+    }
   }
 
   static void setPwmDutyCycle(int16_t newAmperagePwmDutyCycle) {
@@ -32,25 +109,355 @@ namespace AmperagePinManager {
       OCR1B = amperagePwmDutyCycle;
     }
   }
+
+  static int16_t computePwmDutyCycle(int16_t desiredAmperage, int16_t measuredAmperage, int16_t pwmTopLimit) {
+    int32_t error = desiredAmperage - measuredAmperage;
+    // Anti-windup: integral never leaves range the output can reach
+    int32_t integral = integralPwmDutyCycle + KI_Q8 * error;
+    integralPwmDutyCycle = constrain(integral, 0, (int32_t) pwmTopLimit << 8);
+    int32_t output = (integralPwmDutyCycle + CURRENT_CONTROL_KP_Q8 * error) >> 8;
+    return constrain(output, 0, pwmTopLimit);
+  }
   
-  void tuneDischargeCurrent(bool isRefreshCycle) {
+  static void stopCalibration(bool isComplete) {
+    calibration.isRunning = false;
+    isRegulating = false;
+    SystemState::setChangeFlag(SystemState::CurrentCalibration);
+    if (isComplete) {
+      feedForwardTable.checksum = getChecksum(feedForwardTable);
+      EEPROM.put(FEED_FORWARD_TABLE_ADDRESS, feedForwardTable);
+    } else {
+      EEPROM.get(FEED_FORWARD_TABLE_ADDRESS, feedForwardTable);
+      if (feedForwardTable.checksum != getChecksum(feedForwardTable)) {
+        resetFeedForwardTable();
+      }
+    }
+  }
+
+  void startCalibration() {
+    if (calibration.isRunning 
+        || !SystemState::getDeviceStatusIsOn()
+        || SystemState::getDesiredAmperage() < MIN_CURRENT_MA) {
+      return;
+    }
+    resetFeedForwardTable();
+    feedForwardTable.amperage[0] = 0;
+    calibration.isRunning = true;
+    calibration.point = 1;
+    calibration.isRamping = true;
+    calibration.sampleCounter = 0;
+    calibration.amperageSum = 0;
+    setPwmDutyCycle(0); // sweep ramps up from zero
+    SystemState::setChangeFlag(SystemState::CurrentCalibration);
+  }
+
+  bool isCalibrating() {
+    return calibration.isRunning;
+  }
+
+  uint16_t getFeedForwardStep() {
+    return FEED_FORWARD_STEP;
+  }
+
+  uint16_t getFeedForwardAmperage(uint8_t point) {
+    return feedForwardTable.amperage[point];
+  }
+
+  // Called on every new sample while calibration is running. Sweep stops on
+  // the first point above the desired amperage. The ramp to a point stops
+  // early at that amperage, the point is then extended along the measured
+  // line so the table stays exact below it.
+  static void sweepPwmDutyCycle() {
+    uint16_t amperageLimit = SystemState::getDesiredAmperage() + max(SystemState::getDesiredAmperage() / 10, 50);
+    int16_t pointDutyCycle = calibration.point * FEED_FORWARD_STEP;
+    int16_t previousDutyCycle = pointDutyCycle - FEED_FORWARD_STEP;
+    if (calibration.isRamping) {
+      if (amperagePwmDutyCycle <= previousDutyCycle || (amperagePwmDutyCycle < pointDutyCycle 
+          && SystemState::getInstantAmperage() < amperageLimit)) {
+        setPwmDutyCycle(min(max(amperagePwmDutyCycle, previousDutyCycle) + FEED_FORWARD_RAMP_STEP, pointDutyCycle));
+        return;
+      }
+      calibration.isRamping = false;
+    }
+    if (++calibration.sampleCounter <= FEED_FORWARD_SETTLE_SAMPLES) {
+      return;
+    }
+    calibration.amperageSum += SystemState::getInstantAmperage();
+    if (calibration.sampleCounter < FEED_FORWARD_SETTLE_SAMPLES + FEED_FORWARD_AVERAGE_SAMPLES) {
+      return;
+    }
+
+    uint16_t amperage = calibration.amperageSum / FEED_FORWARD_AVERAGE_SAMPLES;
+    calibration.sampleCounter = 0;
+    calibration.amperageSum = 0;
+    uint16_t previousAmperage = feedForwardTable.amperage[calibration.point - 1];
+    if (amperage <= previousAmperage) {
+      stopCalibration(true); // source can not give more current
+      return;
+    }
+    bool isCut = amperagePwmDutyCycle < pointDutyCycle;
+    if (isCut) {
+      amperage = min(previousAmperage + (uint32_t) (amperage - previousAmperage) * FEED_FORWARD_STEP
+          / (amperagePwmDutyCycle - previousDutyCycle), UNKNOWN_AMPERAGE - 1);
+    }
+    feedForwardTable.amperage[calibration.point] = amperage;
+    if (++calibration.point >= FEED_FORWARD_POINTS || isCut || amperage >= amperageLimit) {
+      stopCalibration(true);
+      return;
+    }
+    calibration.isRamping = true;
+  }
+  
+  enum ResistanceMeterState : uint8_t {
+    MeterIdle,
+    MeterBeforeStep, // regulating as usual, averaging last samples
+    MeterStep, // duty cycle raised and held
+    MeterRecovery, // back to regulation before the next step
+  };
+
+  static struct {
+    ResistanceMeterState state;
+    bool isRequested:1;
+    uint8_t stepCounter;
+    uint8_t sampleCounter;
+    int16_t baseDutyCycle;
+    int32_t stepVoltageSum; // mV, before minus after the current step
+    int32_t stepAmperageSum; // mA, after minus before the current step
+    int32_t voltageSum; // mV, steps kept so far
+    int32_t amperageSum; // mA
+    uint32_t lastTime;
+    uint16_t internalResistance; // 0.1 mOhm
+  } resistanceMeter = {MeterIdle, false, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+
+  static void cancelResistanceMeasurement() {
+    resistanceMeter.state = MeterIdle;
+  }
+
+  void startResistanceMeasurement() {
+    resistanceMeter.isRequested = true;
+  }
+
+  bool isMeasuringResistance() {
+    return resistanceMeter.state != MeterIdle;
+  }
+
+  uint16_t getInternalResistance() {
+    return resistanceMeter.internalResistance;
+  }
+
+  // Current may not rise if the source or MAX_CURRENT_MA limits it, such
+  // step adds nothing but noise
+  static void finishResistanceStep() {
+    if (resistanceMeter.stepAmperageSum >= (int32_t) IR_MIN_STEP_AMPERAGE * IR_AVERAGE_SAMPLES
+        && resistanceMeter.stepVoltageSum > 0) {
+      resistanceMeter.voltageSum += resistanceMeter.stepVoltageSum;
+      resistanceMeter.amperageSum += resistanceMeter.stepAmperageSum;
+    }
+    resistanceMeter.stepVoltageSum = 0;
+    resistanceMeter.stepAmperageSum = 0;
+  }
+
+  static void finishResistanceMeasurement() {
+    resistanceMeter.state = MeterIdle;
+    resistanceMeter.lastTime = millis();
+    if (resistanceMeter.amperageSum != 0) {
+      resistanceMeter.internalResistance = min(resistanceMeter.voltageSum * 10000 / resistanceMeter.amperageSum, 0xFFFFL);
+    }
+  }
+
+  // Called on every new sample while regulating, returns true while the
+  // step holds duty cycle and PI controller should stay away
+  static bool stepResistanceMeasurement(uint16_t baseAmperage) {
+    int32_t voltage = SystemState::getInstantVoltage();
+    int32_t amperage = SystemState::getInstantAmperage();
+    switch (resistanceMeter.state) {
+      case MeterIdle:
+        // Periodic steps would disturb power, resistance and voltage modes,
+        // only battery discharge at constant current gets them
+        if (resistanceMeter.isRequested
+            || (IR_MEASUREMENT_INTERVAL_MS != 0 && SystemState::getLoadMode() == SystemState::ConstantCurrent
+                && millis() - resistanceMeter.lastTime >= IR_MEASUREMENT_INTERVAL_MS)) {
+          resistanceMeter = {MeterBeforeStep, false, 0, 0, 0, 0, 0, 0, 0,
+              resistanceMeter.lastTime, resistanceMeter.internalResistance};
+        }
+        return false;
+
+      case MeterBeforeStep: {
+        // Sums hold before step values with opposite sign until the step ends
+        resistanceMeter.stepVoltageSum += voltage;
+        resistanceMeter.stepAmperageSum -= amperage;
+        if (++resistanceMeter.sampleCounter < IR_AVERAGE_SAMPLES) {
+          return false;
+        }
+        uint16_t stepAmperage = min(IR_STEP_AMPERAGE, MAX_CURRENT_MA - baseAmperage);
+        if (stepAmperage < IR_MIN_STEP_AMPERAGE) {
+          finishResistanceMeasurement(); // no room above the setpoint
+          return false;
+        }
+        resistanceMeter.baseDutyCycle = amperagePwmDutyCycle;
+        resistanceMeter.sampleCounter = 0;
+        resistanceMeter.state = MeterStep;
+        setPwmDutyCycle(amperagePwmDutyCycle + predictPwmDutyCycle(baseAmperage + stepAmperage) 
+            - predictPwmDutyCycle(baseAmperage));
+        return true;
+      }
+
+      case MeterStep:
+        if (++resistanceMeter.sampleCounter > IR_STEP_DELAY_SAMPLES) {
+          resistanceMeter.stepVoltageSum -= voltage;
+          resistanceMeter.stepAmperageSum += amperage;
+        }
+        if (resistanceMeter.sampleCounter < IR_STEP_DELAY_SAMPLES + IR_AVERAGE_SAMPLES) {
+          return true;
+        }
+        finishResistanceStep();
+        setPwmDutyCycle(resistanceMeter.baseDutyCycle);
+        resistanceMeter.sampleCounter = 0;
+        resistanceMeter.state = MeterRecovery;
+        return true;
+
+      case MeterRecovery:
+        if (++resistanceMeter.sampleCounter < IR_RECOVERY_SAMPLES) {
+          return false;
+        }
+        resistanceMeter.sampleCounter = 0;
+        if (++resistanceMeter.stepCounter >= IR_STEPS) {
+          finishResistanceMeasurement();
+        } else {
+          resistanceMeter.state = MeterBeforeStep;
+        }
+        return false;
+    }
+    return false;
+  }
+
+  // Current that gives desired power, resistance or voltage at the latest
+  // measured voltage, so the target follows the source on every sample
+  static uint16_t computeTargetAmperage(bool isNewSample) {
+    uint32_t voltage = SystemState::getInstantVoltage();
+    uint32_t amperage;
+    switch (SystemState::getLoadMode()) {
+      case SystemState::ConstantPower:
+        amperage = voltage <= NOISE_VOLTAGE ? 0 : SystemState::getDesiredPower() * 1000 / voltage;
+        break;
+      case SystemState::ConstantResistance:
+        amperage = SystemState::getDesiredResistance() == 0 ? 0 
+            : voltage * 1000 / SystemState::getDesiredResistance();
+        break;
+      case SystemState::ConstantVoltage:
+        // Sink more current while source stays above the desired voltage
+        if (isNewSample) {
+          int32_t error = (int32_t) voltage - (int32_t) SystemState::getDesiredVoltage();
+          int32_t integral = voltageModeAmperage + CONSTANT_VOLTAGE_KI_Q8 * error;
+          voltageModeAmperage = constrain(integral, 0, (int32_t) MAX_CURRENT_MA << 8);
+        }
+        amperage = voltageModeAmperage >> 8;
+        break;
+      default:
+        amperage = SystemState::getDesiredAmperage();
+        break;
+    }
+    return min(amperage, (uint32_t) MAX_CURRENT_MA);
+  }
+
+  // Both levels come from feed-forward table only, there is no time to
+  // regulate within a period
+  static void startTransientLoad() {
+    isRegulating = false;
+    uint8_t period = max(SystemState::getTransientPeriod(), TRANSIENT_MIN_PERIOD_MS);
+    uint8_t highTicks = constrain((uint16_t) period * SystemState::getTransientDuty() / 100, 1, period - 1);
+    uint16_t lowAmperage = SystemState::getTransientLowAmperage();
+    uint16_t highAmperage = SystemState::getDesiredAmperage();
+    TransientLoad::start(
+        lowAmperage < MIN_CURRENT_MA ? 0 : predictPwmDutyCycle(lowAmperage),
+        highAmperage < MIN_CURRENT_MA ? 0 : predictPwmDutyCycle(highAmperage),
+        period - highTicks, highTicks);
+  }
+
+  void tuneDischargeCurrent() {
 #if ENABLE_AMPERAGE_CALIBRATION
     setPwmDutyCycle(SystemState::getDesiredAmperage());
     return;
 # endif
-    if (!SystemState::getDeviceStatusIsOn() || SystemState::getAverageVoltage() == 0 || SystemState::getDesiredAmperage() < MIN_CURRENT_MA) {
+    bool isTransient = !calibration.isRunning && SystemState::getDeviceStatusIsOn()
+        && SystemState::getAverageVoltage() != 0
+        && SystemState::getLoadMode() == SystemState::Transient;
+    if (isTransient || calibration.isRunning) {
+      cancelResistanceMeasurement();
+    }
+    if (!isTransient && TransientLoad::isRunning()) {
+      TransientLoad::stop();
+      amperagePwmDutyCycle = -1; // OCR1B is left at whatever level interrupt set
+    }
+    if (calibration.isRunning) {
+      if (!SystemState::getDeviceStatusIsOn() || SystemState::getAverageVoltage() == 0) {
+        stopCalibration(false);
+        setPwmDutyCycle(0);
+      } else if (SystemState::isChanged(SystemState::NewMeasurement)) {
+        sweepPwmDutyCycle();
+      }
+      return;
+    }
+    if (!SystemState::getDeviceStatusIsOn() || SystemState::getAverageVoltage() == 0) {
+      isRegulating = false;
+      voltageModeAmperage = 0;
+      cancelResistanceMeasurement();
+      setPwmDutyCycle(0);
+      return;
+    }
+    bool isNewSample = SystemState::isChanged(SystemState::NewMeasurement);
+    bool isSetpointChanged = SystemState::isChanged(SystemState::DesiredAmperage)
+        || SystemState::isChanged(SystemState::LoadSetpoint);
+    if (isTransient) {
+      if (!TransientLoad::isRunning() || isSetpointChanged) {
+        startTransientLoad();
+      }
+      return;
+    }
+    if (isRegulating && !isNewSample && !isSetpointChanged) {
+      return;
+    }
+    uint16_t newTargetAmperage = computeTargetAmperage(isNewSample);
+    if (newTargetAmperage < MIN_CURRENT_MA) {
+      isRegulating = false;
+      cancelResistanceMeasurement();
       setPwmDutyCycle(0);
-    } else if (isRefreshCycle) {
-      int16_t pwmTopLimit = SystemState::getDesiredAmperage() + max(SystemState::getDesiredAmperage() / 10, 50);
-      int16_t step = getStep(SystemState::getDesiredAmperage() - SystemState::getAverageAmperage());
-      setPwmDutyCycle(min(amperagePwmDutyCycle + step, pwmTopLimit));
+    } else if (!isRegulating || isSetpointChanged) {
+      cancelResistanceMeasurement();
+      // Jump straight to predicted duty cycle, PI controller removes the rest
+      int16_t dutyCycle = predictPwmDutyCycle(newTargetAmperage);
+      integralPwmDutyCycle = (int32_t) dutyCycle << 8;
+      isRegulating = true;
+      jumpTime = millis();
+      setPwmDutyCycle(dutyCycle);
+    } else if (SystemState::getMeasurementTime() - jumpTime < SAMPLE_PERIOD_MS) {
+      // Sample was taken before the jump took effect, PI would kick backwards
+    } else {
+      if (newTargetAmperage != targetAmperage) {
+        // Feed-forward moves with the target, PI corrects only the residual
+        integralPwmDutyCycle += (int32_t) (predictPwmDutyCycle(newTargetAmperage) 
+            - predictPwmDutyCycle(targetAmperage)) << 8;
+      }
+      if (!stepResistanceMeasurement(newTargetAmperage)) {
+        int16_t pwmTopLimit = newTargetAmperage + max(newTargetAmperage / 10, 50);
+        setPwmDutyCycle(computePwmDutyCycle(newTargetAmperage, SystemState::getInstantAmperage(), pwmTopLimit));
+      }
     }
+    targetAmperage = newTargetAmperage;
+  }
+
+  uint16_t getTargetAmperage() {
+    return isRegulating ? targetAmperage : 0;
   }
 };
 
 
 namespace EmergencyManager {
   static uint16_t emergency = EmergencyType::Calmness;
+  // Set by interrupt, cleared by loop() when load is switched on
+  static volatile uint16_t tripReason = 0;
+  static volatile bool isTripPending = false;
+  static volatile uint16_t tripLatency = 0;
 
   void setEmergency(uint16_t newValue) {
     if (newValue == emergency) {
@@ -61,6 +468,7 @@ namespace EmergencyManager {
     emergency = newValue;
     if (oldMainEmergency != getMainEmergency()) {
       SystemState::setChangeFlag(SystemState::MainEmergency);
+      SdCardLogger::flush();
     }
   }
 
@@ -91,7 +499,8 @@ namespace EmergencyManager {
     if (mV >= EMERGENCY_VOLTAGE) {
       setEmergency(emergency | EmergencyType::OverVoltage);
       SystemState::setDeviceStatusIsOn(false);
-    } else {
+    } else if (!(getTripReason() & EmergencyType::OverVoltage)) {
+      // Fast trip reason stays on screen until the load is switched on
       setEmergency(emergency & ~EmergencyType::OverVoltage);
     }
   }
@@ -115,24 +524,86 @@ namespace EmergencyManager {
   }
 
   void cleanUnnecessaryEmergencyFlags() {
-    if (emergency & EmergencyType::MosfetFaults
-        && SystemState::isChanged(SystemState::DeviceStatusIsOn)
-        && SystemState::getDeviceStatusIsOn()) {
-      setEmergency(emergency & ~(EmergencyType::MosfetFaults));
+    if (!SystemState::isChanged(SystemState::DeviceStatusIsOn) || !SystemState::getDeviceStatusIsOn()) {
+      return;
+    }
+    uint16_t reason;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      reason = tripReason;
+      tripReason = 0;
+    }
+    uint16_t cleared = reason | EmergencyType::MosfetFaults | EmergencyType::OverCurrent;
+    if (emergency & cleared) {
+      setEmergency(emergency & ~cleared);
     }
   }
 
+  void trip(uint16_t reason, uint32_t sampleTime) {
+    digitalWrite(AMPERAGE_ON_OFF_PIN, LOW);
+    TransientLoad::stop();
+    OCR1B = 0;
+    tripLatency = min(micros() - sampleTime, 0xFFFFUL);
+    tripReason |= reason;
+    isTripPending = true;
+  }
+
+  void reportTrip() {
+    if (!isTripPending) {
+      return;
+    }
+    uint16_t reason;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      isTripPending = false;
+      reason = tripReason;
+    }
+    setEmergency(emergency | reason);
+    SystemState::setDeviceStatusIsOn(false);
+  }
+
+  uint16_t getTripReason() {
+    uint16_t reason;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      reason = tripReason;
+    }
+    return reason;
+  }
+
+  uint16_t getTripLatency() {
+    uint16_t latency;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      latency = tripLatency;
+    }
+    return latency;
+  }
+
   void updateOnOffState() {
     checkOverHeat();
     checkOverVoltage();
     checkStopVoltageReached();
     cleanUnnecessaryEmergencyFlags();
-    bool isOn = SystemState::getDeviceStatusIsOn() && SystemState::getDesiredAmperage() >= MIN_CURRENT_MA;
-    digitalWrite(AMPERAGE_ON_OFF_PIN, isOn ? HIGH : LOW);
+    // Current setpoints below minimum are off, other modes need any setpoint
+    SystemState::LoadMode loadMode = SystemState::getLoadMode();
+    bool isCurrentMode = loadMode == SystemState::ConstantCurrent || loadMode == SystemState::Transient;
+    bool isOn = SystemState::getDeviceStatusIsOn()
+        && SystemState::getLoadSetpoint() >= (isCurrentMode ? MIN_CURRENT_MA : 1);
+    bool isLoadOn;
+    // Trip may come in between, it should not be switched back on
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      isLoadOn = isOn && tripReason == 0;
+      digitalWrite(AMPERAGE_ON_OFF_PIN, isLoadOn ? HIGH : LOW);
+    }
+#if SD_CARD_RAW_CAPTURE
+    // Capture starts with the first sample of the switched on load
+    RawCapture::setEnabled(isLoadOn);
+#endif
+  }
+
+  uint16_t getEmergency() {
+    return emergency;
   }
 
   uint16_t getMainEmergency() {
-    for (uint16_t mask = 1; mask != (1 << 16); mask = (mask << 1)) {
+    for (uint16_t mask = 1; mask != 0; mask <<= 1) {
       if (emergency & mask) {
         return mask;
       }
@@ -147,6 +618,9 @@ namespace EmergencyManager {
     if (emergency & OverHeat) {
       return F("Over Heat");
     }
+    if (emergency & OverCurrent) {
+      return F("Over Current");
+    }
     if (emergency & MosfetFault_1) {
       return F("Mosfet Fault #1");
     }
@@ -207,34 +681,65 @@ namespace FanManager {
 };
 
 namespace FanTemperatureReader {
-  static AverageValueCalculator<int, uint32_t> thermistorPinValue;
+  // Sum of 16 readings is in 1/16 LSB like the thermistor table input, ADC
+  // noise dithers the two extra bits of resolution
+  static const uint8_t OVERSAMPLING_BITS = 4;
+  static_assert(OVERSAMPLING_BITS == ThermistorTable::ADC_FRACTION_BITS, "Oversampled sum should be in table units");
+
+  struct Accumulator {
+    uint32_t sum;
+    uint16_t counter;
+  };
+
+  // ADC interrupt adds to the active accumulator, main loop takes the other
+  // one, so neither waits for the other
+  static volatile Accumulator accumulators[2];
+  static volatile uint8_t activeAccumulator = 0;
+  static uint16_t oversampledSum = 0;
+  static uint8_t oversampledCounter = 0;
 
   void setup() {
     pinMode(THERMISTOR_PIN, INPUT);
+    // AVcc reference, same as analogRead() uses
+    ADMUX = _BV(REFS0) | ((THERMISTOR_PIN - A0) & 0x07);
+    // Timer1 overflow starts conversions at the tick rate, in the same place
+    // of the pwm period, its interrupt clears the flag for the next trigger.
+    // 125 kHz ADC clock, 104 us per conversion
+    ADCSRB = _BV(ADTS2) | _BV(ADTS1);
+    ADCSRA = _BV(ADEN) | _BV(ADATE) | _BV(ADIF) | _BV(ADIE) | _BV(ADPS2) | _BV(ADPS1) | _BV(ADPS0);
   }
 
-  void makeMeasurement() {
-    thermistorPinValue.addMeasurement(analogRead(THERMISTOR_PIN));
+  void addMeasurement(uint16_t value) {
+    oversampledSum += value;
+    if (++oversampledCounter < _BV(OVERSAMPLING_BITS)) {
+      return;
+    }
+    volatile Accumulator &accumulator = accumulators[activeAccumulator];
+    accumulator.sum += oversampledSum;
+    accumulator.counter += 1;
+    oversampledSum = 0;
+    oversampledCounter = 0;
   }
 
   void updateAverageTemperatureValue() {
-    float temperature = thermistorPinValue.calculateAverageValue();
-
-    // convert the value to resistance
-    temperature = 1023 / temperature - 1;
-    temperature = THERMISTOR_SERIES_RESISTOR / temperature;
-
-    temperature = temperature / THERMISTOR_NOMINAL;     // (R/Ro)
-    temperature = log(temperature);                  // ln(R/Ro)
-    temperature /= B_COEFFICIENT;                   // 1/B * ln(R/Ro)
-    temperature += 1.0 / (TEMPERATURE_NOMINAL + 273.15); // + (1/To)
-    temperature = 1.0 / temperature;                 // Invert
-    temperature -= 273.15;                         // convert to C
-
-    SystemState::setAverageTemperature(constrain(round(temperature * 10), -999, 2000)); // 4 digits
+    // Interrupt can not run in the middle of it, single byte store
+    uint8_t taken = activeAccumulator;
+    activeAccumulator = taken ^ 1;
+    volatile Accumulator &accumulator = accumulators[taken];
+    if (accumulator.counter == 0) {
+      return;
+    }
+    uint16_t adcValue = accumulator.sum / accumulator.counter;
+    accumulator.sum = 0;
+    accumulator.counter = 0;
+    SystemState::setAverageTemperature(ThermistorTable::toTemperature(adcValue));
   }
 };
 
+ISR(ADC_vect) {
+  FanTemperatureReader::addMeasurement(ADC);
+}
+
 
 namespace SdCardLogger {
   static struct {
@@ -244,9 +749,29 @@ namespace SdCardLogger {
   } state = {false, 1, 0};
    
   static SdFat sd;
+  static SdFile logFile;
+  static uint8_t unflushedRecords = 0;
+
+  static WriteStats writeStats = {0, 0, 0};
 
   static const PROGMEM char log[3] = "log";
-  static const PROGMEM char dotCsv[4] = ".csv";
+#if SD_CARD_RAW_CAPTURE
+  static const PROGMEM char dotExtension[4] = ".raw";
+  static const uint8_t DATA_OFFSET = sizeof(BinaryLog::RawHeader);
+  static const uint8_t DATA_UNIT_SIZE = sizeof(BinaryLog::RawRecord);
+  static const uint8_t DATA_PROBE_SIZE = sizeof(uint32_t);
+#elif SD_CARD_LOG_FORMAT_BINARY
+  static const PROGMEM char dotExtension[4] = ".bin";
+  // Erased record is detected by its timestamp
+  static const uint8_t DATA_OFFSET = sizeof(BinaryLog::Header);
+  static const uint8_t DATA_UNIT_SIZE = sizeof(BinaryLog::Record);
+  static const uint8_t DATA_PROBE_SIZE = sizeof(uint32_t);
+#else
+  static const PROGMEM char dotExtension[4] = ".csv";
+  static const uint8_t DATA_OFFSET = 0;
+  static const uint8_t DATA_UNIT_SIZE = 1;
+  static const uint8_t DATA_PROBE_SIZE = 1;
+#endif
 
   static inline void setFault() {
     state.isFault = true;
@@ -265,7 +790,7 @@ namespace SdCardLogger {
       buffer[i] = '0' + number % 10;
       number = number / 10;
     }
-    memcpy_P(buffer + 7, dotCsv, 4);
+    memcpy_P(buffer + 7, dotExtension, 4);
     buffer[11] = '\0';
     return buffer;
   }
@@ -297,10 +822,9 @@ namespace SdCardLogger {
         goto skip;
       }
 
-      String sdCardFileName(fileName);
       if (strlen(fileName) != 11 ||
           strncmp_P(&fileName[0], log, 3) != 0 ||
-          strncmp_P(&fileName[7], dotCsv, 4) != 0) {
+          strncmp_P(&fileName[7], dotExtension, 4) != 0) {
         goto skip;
       }
       
@@ -316,6 +840,202 @@ skip:
     }
   }
   
+  const WriteStats &getWriteStats() {
+    return writeStats;
+  }
+
+  void resetWriteStats() {
+    writeStats = {0, 0, 0};
+  }
+
+  static void updateWriteStats(uint32_t writeTime) {
+    writeStats.maxWriteTime = max(writeStats.maxWriteTime, writeTime);
+    writeStats.totalWriteTime += writeTime;
+    ++writeStats.writeCount;
+  }
+
+  // Preallocated space is erased and reads as 0x00 or 0xFF depending on card
+  static bool isEndOfData(uint32_t unit) {
+    uint32_t probe = 0;
+    if (!logFile.seekSet(DATA_OFFSET + unit * DATA_UNIT_SIZE)
+        || logFile.read(&probe, DATA_PROBE_SIZE) != DATA_PROBE_SIZE) {
+      return true;
+    }
+    return probe == 0 || probe == 0xFFFFFFFF >> (32 - 8 * DATA_PROBE_SIZE);
+  }
+
+  // File may keep preallocated tail if power was lost before it was closed
+  static uint32_t findEndOfData() {
+    uint32_t fileSize = logFile.fileSize();
+    if (fileSize <= DATA_OFFSET) {
+      return fileSize;
+    }
+    uint32_t high = (fileSize - DATA_OFFSET) / DATA_UNIT_SIZE;
+    if (!isEndOfData(high - 1)) {
+      return DATA_OFFSET + high * DATA_UNIT_SIZE;
+    }
+    uint32_t low = 0;
+    while (low < high) {
+      uint32_t middle = (low + high) / 2;
+      if (isEndOfData(middle)) {
+        high = middle;
+      } else {
+        low = middle + 1;
+      }
+    }
+    return DATA_OFFSET + low * DATA_UNIT_SIZE;
+  }
+
+  static bool writeFileHeader() {
+#if SD_CARD_RAW_CAPTURE
+    RawCapture::resetOverrunRecords();
+    BinaryLog::RawHeader header = {
+      BinaryLog::RAW_MAGIC,
+      BinaryLog::VERSION,
+      sizeof(BinaryLog::RawHeader),
+      sizeof(BinaryLog::RawRecord),
+      SAMPLE_RATE_HZ,
+      0,
+    };
+    return logFile.write(&header, sizeof(header)) == sizeof(header);
+#elif SD_CARD_LOG_FORMAT_BINARY
+    BinaryLog::Header header = {
+      BinaryLog::MAGIC,
+      BinaryLog::VERSION,
+      sizeof(BinaryLog::Header),
+      sizeof(BinaryLog::Record),
+      SAMPLE_RATE_HZ,
+      REFRESH_INTERVAL_MS,
+      AmperagePinManager::getFeedForwardStep(),
+    };
+    for (uint8_t i = 0; i < FEED_FORWARD_POINTS; ++i) {
+      header.feedForwardAmperage[i] = AmperagePinManager::getFeedForwardAmperage(i);
+    }
+    return logFile.write(&header, sizeof(header)) == sizeof(header);
+#else
+    return logFile.println(F("Amperage(mA),Voltage(mV),Charge(mAh),Energy(mWh),Resistance(mOhm)")) != 0;
+#endif
+  }
+
+  static bool writeRecord() {
+#if SD_CARD_LOG_FORMAT_BINARY
+    BinaryLog::Record record = {
+      millis(),
+      SystemState::getInstantAmperage(),
+      SystemState::getAverageAmperage(),
+      (uint16_t) SystemState::getInstantVoltage(),
+      (uint16_t) SystemState::getAverageVoltage(),
+      SystemState::getAverageTemperature(),
+      SystemState::getAverageCharge(),
+      SystemState::getAverageEnergy(),
+      EmergencyManager::getEmergency(),
+      AmperagePinManager::getInternalResistance(),
+    };
+    return logFile.write(&record, sizeof(record)) == sizeof(record);
+#else
+    size_t printSize = 0;
+    printSize += logFile.print(SystemState::getAverageAmperage());
+    printSize += logFile.print(',');
+    printSize += logFile.print(SystemState::getAverageVoltage());
+    printSize += logFile.print(',');
+    printSize += logFile.print(SystemState::getAverageCharge(), 0);
+    printSize += logFile.print(',');
+    printSize += logFile.print(SystemState::getAverageEnergy(), 0);
+    printSize += logFile.print(',');
+    uint16_t internalResistance = AmperagePinManager::getInternalResistance();
+    if (internalResistance != 0) {
+      printSize += logFile.print(internalResistance / 10);
+      printSize += logFile.print('.');
+      printSize += logFile.print(internalResistance % 10);
+    }
+    printSize += logFile.println();
+    return printSize != 0;
+#endif
+  }
+
+  static bool createLogFile(const char *fileName) {
+    uint32_t firstBlock, lastBlock;
+    if (!logFile.createContiguous(fileName, SD_CARD_PREALLOCATE_BYTES)
+        || !logFile.contiguousRange(&firstBlock, &lastBlock)
+        || !sd.card()->erase(firstBlock, lastBlock)) {
+      // Card is too fragmented, fall back to cluster by cluster allocation
+      if (logFile.isOpen()) {
+        logFile.close();
+      }
+      if (!logFile.open(fileName, O_CREAT | O_RDWR | O_TRUNC)) {
+        return false;
+      }
+    }
+    return writeFileHeader() && logFile.sync();
+  }
+
+  static bool openLogFile() {
+    if (logFile.isOpen()) {
+      return true;
+    }
+    const char buffer[12];
+    constructFileName(buffer);
+    if (!sd.exists(buffer)) {
+      return createLogFile(buffer);
+    }
+    return logFile.open(buffer, O_RDWR) && logFile.seekSet(findEndOfData());
+  }
+
+  static void closeLogFile() {
+    if (!logFile.isOpen()) {
+      return;
+    }
+    // Cut off unused preallocated space
+    if (!logFile.truncate(logFile.curPosition()) || !logFile.close()) {
+      setFault();
+    }
+  }
+
+  // Overrun counter in the header covers the file up to the last flush
+  static bool updateRawHeader() {
+#if SD_CARD_RAW_CAPTURE
+    uint32_t position = logFile.curPosition();
+    uint32_t overrunRecords = RawCapture::getOverrunRecords();
+    return logFile.seekSet(offsetof(BinaryLog::RawHeader, overrunRecords))
+        && logFile.write(&overrunRecords, sizeof(overrunRecords)) == sizeof(overrunRecords)
+        && logFile.seekSet(position);
+#else
+    return true;
+#endif
+  }
+
+  void flush() {
+    if (isFault() || !logFile.isOpen() || unflushedRecords == 0) {
+      return;
+    }
+    unflushedRecords = 0;
+    uint32_t startTime = micros();
+    if (!updateRawHeader() || !logFile.sync()) {
+      setFault();
+    }
+    updateWriteStats(micros() - startTime);
+  }
+
+  void writeRawCapture() {
+#if SD_CARD_RAW_CAPTURE
+    const BinaryLog::RawRecord *records;
+    uint8_t length;
+    while (!isFault() && RawCapture::getFullBuffer(records, length)) {
+      if (openLogFile()) {
+        uint32_t startTime = micros();
+        size_t size = length * sizeof(BinaryLog::RawRecord);
+        if (logFile.write(records, size) != (int) size) {
+          setFault();
+        }
+        updateWriteStats(micros() - startTime);
+      } else {
+        setFault();
+      }
+      RawCapture::releaseFullBuffer();
+    }
+#endif
+  }
+  
   void writeSystemState() {
     if (isFault()) {
       return;
@@ -332,24 +1052,37 @@ skip:
       state.lastOffWrite = 3;
     }
 
-    SdFile logFile;
-    const char buffer[12];
-    if (logFile.open(constructFileName(buffer), O_CREAT | O_WRITE | O_AT_END)) {
-      size_t printSize = 0;
-      printSize += logFile.print(SystemState::getAverageAmperage());
-      printSize += logFile.print(',');
-      printSize += logFile.print(SystemState::getAverageVoltage());
-      printSize += logFile.print(',');
-      printSize += logFile.print(SystemState::getAverageCharge(), 0);
-      printSize += logFile.print(',');
-      printSize += logFile.print(SystemState::getAverageEnergy(), 0);
-      printSize += logFile.println();
-      logFile.close();
-      if (printSize == 0) {
-        setFault();
-      }
-    } else {
+#if SD_CARD_RAW_CAPTURE
+    // Samples are written by writeRawCapture(), only flush them here
+    if (++unflushedRecords >= SD_CARD_FLUSH_INTERVAL_RECORDS || state.lastOffWrite == 0) {
+      flush();
+    }
+    if (state.lastOffWrite == 0) {
+      closeLogFile();
+    }
+    return;
+#endif
+
+    if (!openLogFile()) {
+      setFault();
+      return;
+    }
+
+    uint32_t startTime = micros();
+    bool isWritten = writeRecord();
+    updateWriteStats(micros() - startTime);
+    if (!isWritten) {
       setFault();
+      return;
+    }
+
+    // Records stay in SdFat block cache until it is full or file is synced
+    if (++unflushedRecords >= SD_CARD_FLUSH_INTERVAL_RECORDS || state.lastOffWrite == 0) {
+      flush();
+    }
+    // Load stopped, file is reopened and appended to on the next start
+    if (state.lastOffWrite == 0) {
+      closeLogFile();
     }
   }
 
@@ -357,20 +1090,19 @@ skip:
     if (isFault()) {
       return;
     }
+    closeLogFile();
     if (++state.logNumber > 9999) {
       state.logNumber = 0;
     }
     SystemState::setChangeFlag(SystemState::SdCardLogFile);
     const char buffer[12];
-    SdFile logFile;
-    if (!logFile.open(constructFileName(buffer), O_CREAT | O_WRITE | O_TRUNC)) {
+    if (sd.exists(constructFileName(buffer)) && !sd.remove(buffer)) {
       setFault();
       return;
     }
-    if (logFile.println(F("Amperage(mA),Voltage(mV),Charge(mAh),Energy(mWh)")) == 0) {
+    if (!createLogFile(buffer)) {
       setFault();
     }
-    logFile.close();
   }
 
   void printFileName(const Print &printer) {
@@ -380,83 +1112,547 @@ skip:
 };
 
 
+// Log of records in a ring of slots below feed-forward table. Every record
+// goes to the next slot, so wear spreads over the whole ring, and the
+// previous record stays intact while the next one is written. Bytes are
+// written one per update() call as EEPROM gets ready, sequence byte last,
+// so record without it is never newer than the previous one.
 namespace PersistenceStateManager {
-  static uint8_t cycleCount;
-  
-  struct PersistenceState {
+  static const uint8_t RECORD_VERSION = 1; // seeds crc, other layouts fail it
+
+  struct __attribute__((packed)) PersistenceState {
     float averageCharge;
     float averageEnergy;
+    uint32_t stopVoltage;
+    uint32_t desiredPower;
+    uint32_t desiredResistance;
+    uint32_t desiredVoltage;
+    uint16_t desiredAmperage;
+    uint16_t transientLowAmperage;
+    uint8_t transientPeriod;
+    uint8_t transientDuty;
+    uint8_t loadMode;
+  };
+
+  struct __attribute__((packed)) Record {
+    uint8_t sequence;
+    PersistenceState state;
+    uint16_t crc;
   };
 
-  uint16_t getOffsetAddress(uint16_t shift = 0) {
-    uint16_t offsetAddress;
-    uint16_t offsetStorageAddress = EEPROM.length() - sizeof(offsetAddress);
-    EEPROM.get(offsetStorageAddress, offsetAddress);
-    offsetAddress += shift;
-    if (offsetAddress >= offsetStorageAddress) {
-      offsetAddress = 0;
+  // Last two bytes of EEPROM held slot offset of older firmware, they stay
+  // unused so feed-forward table keeps its place
+  static const uint8_t SLOT_COUNT = AmperagePinManager::FEED_FORWARD_TABLE_ADDRESS / sizeof(Record);
+  static_assert(SLOT_COUNT > 1 && SLOT_COUNT < 128, "sequence comparison needs 2..127 slots");
+
+  static uint8_t cycleCount;
+  static Record record; // last preserved
+  static uint8_t slot; // of last preserved record
+  static int8_t writePosition = -1; // next byte of record to write, -1 if done
+
+  static uint16_t getCrc(const Record &candidate) {
+    const uint8_t *bytes = (const uint8_t *) &candidate;
+    uint16_t crc = TelemetryProtocol::crcUpdate(0xFFFF, RECORD_VERSION);
+    for (uint8_t i = 0; i < offsetof(Record, crc); ++i) {
+      crc = TelemetryProtocol::crcUpdate(crc, bytes[i]);
     }
-    return offsetAddress;
+    return crc;
   }
 
-  void setup() {
-    PersistenceState persistenceState;
-    EEPROM.get(getOffsetAddress(), persistenceState);
-    SystemState::restoreAverageChargeAndEnergy(persistenceState.averageCharge, persistenceState.averageEnergy);
+  static uint16_t getSlotAddress(uint8_t index) {
+    return index * sizeof(Record);
   }
 
-  uint16_t shiftAddress() {
-    uint16_t offsetAddress = getOffsetAddress(sizeof(PersistenceState));
-    EEPROM.put(EEPROM.length() - sizeof(offsetAddress), offsetAddress);
-    return offsetAddress;
+  static void captureState(PersistenceState &state) {
+    state.averageCharge = SystemState::getAverageCharge();
+    state.averageEnergy = SystemState::getAverageEnergy();
+    state.stopVoltage = SystemState::getStopVoltage();
+    state.desiredPower = SystemState::getDesiredPower();
+    state.desiredResistance = SystemState::getDesiredResistance();
+    state.desiredVoltage = SystemState::getDesiredVoltage();
+    state.desiredAmperage = SystemState::getDesiredAmperage();
+    state.transientLowAmperage = SystemState::getTransientLowAmperage();
+    state.transientPeriod = SystemState::getTransientPeriod();
+    state.transientDuty = SystemState::getTransientDuty();
+    state.loadMode = SystemState::getLoadMode();
+  }
+
+  static void restoreState(const PersistenceState &state) {
+    SystemState::restoreAverageChargeAndEnergy(state.averageCharge, state.averageEnergy);
+    SystemState::setStopVoltage(state.stopVoltage);
+    SystemState::setDesiredPower(state.desiredPower);
+    SystemState::setDesiredResistance(state.desiredResistance);
+    SystemState::setDesiredVoltage(state.desiredVoltage);
+    SystemState::setDesiredAmperage(state.desiredAmperage);
+    SystemState::setTransientLowAmperage(state.transientLowAmperage);
+    SystemState::setTransientPeriod(state.transientPeriod);
+    SystemState::setTransientDuty(state.transientDuty);
+    if (state.loadMode < SystemState::LoadModeCount) {
+      SystemState::setLoadMode((SystemState::LoadMode) state.loadMode);
+    }
+  }
+
+  // Newest valid record wins. Valid sequences are less than SLOT_COUNT
+  // apart, so 8 bit wrapping difference orders them.
+  void setup() {
+    bool isFound = false;
+    Record candidate;
+    for (uint8_t i = 0; i < SLOT_COUNT; ++i) {
+      EEPROM.get(getSlotAddress(i), candidate);
+      if (candidate.crc != getCrc(candidate)) {
+        continue;
+      }
+      if (!isFound || (int8_t) (candidate.sequence - record.sequence) > 0) {
+        record = candidate;
+        slot = i;
+        isFound = true;
+      }
+    }
+    if (isFound) {
+      restoreState(record.state);
+    } else {
+      slot = SLOT_COUNT - 1;
+      captureState(record.state);
+    }
   }
 
   void preserve() {
-    if (++cycleCount < SD_CARD_DUMP_INTERVAL_CYCLES) {
+    if (++cycleCount < SD_CARD_DUMP_INTERVAL_CYCLES || writePosition >= 0) {
       return;
     }
     cycleCount = 0;
-    bool needShift = random(1000) == 0;
-    PersistenceState persistenceState = {
-      SystemState::getAverageCharge(),
-      SystemState::getAverageEnergy(),
-    };
+    PersistenceState state;
+    captureState(state);
+    if (memcmp(&state, &record.state, sizeof(state)) == 0) {
+      return;
+    }
+    record.state = state;
+    ++record.sequence;
+    record.crc = getCrc(record);
+    slot = (slot + 1) % SLOT_COUNT;
+    writePosition = 1;
+  }
 
-    EEPROM.put(needShift ? shiftAddress() : getOffsetAddress(), persistenceState);
+  void update() {
+    if (writePosition < 0 || !eeprom_is_ready()) {
+      return;
+    }
+    uint8_t position = writePosition;
+    EEPROM.update(getSlotAddress(slot) + position, ((const uint8_t *) &record)[position]);
+    if (position == 0) {
+      writePosition = -1;
+    } else if (++writePosition == sizeof(Record)) {
+      writePosition = 0; // sequence commits the record
+    }
   }
 };
 
 
 
 namespace GaugeReader {
-  Adafruit_INA219 ina219 = Adafruit_INA219(INA219_I2C_ADDRESS);
+  static const uint8_t INA219_REG_CONFIG = 0x00;
+  static const uint8_t INA219_REG_SHUNTVOLTAGE = 0x01;
+  static const uint8_t INA219_REG_BUSVOLTAGE = 0x02;
+  // 32V bus range, 320mV shunt range, 12 bit ADC, continuous shunt and bus
+  static const uint16_t INA219_CONFIG = 0x399F;
 
-  void setup() {
-    ina219.begin();
+  // Raw register limits, calibration is within 1% there
+  static const int16_t TRIP_SHUNT_VOLTAGE = GaugeCalibration::shuntFromAmperage(TRIP_AMPERAGE);
+  // Bus register is the pin voltage the INA219 limit applies to
+  static const uint16_t TRIP_BUS_VOLTAGE = (TRIP_VOLTAGE / 4) << 3;
+  static_assert(TRIP_VOLTAGE > EMERGENCY_VOLTAGE && TRIP_VOLTAGE < 26000,
+      "Trip should be between averaged limit and INA219 maximum");
+
+  struct Sample {
+    uint32_t timestamp; // ms, time the sample was scheduled
+    uint16_t amperage;  // mA
+    uint16_t voltage;   // mV
+    uint8_t captureTag; // TransientLoad edge offset
+    bool isRegular; // false for extra edge capture reads
+  };
+
+  static RingBuffer<Sample, 4> samples;
+  static uint32_t pendingTimestamp;
+  static uint8_t pendingCaptureTag;
+  static bool isPendingRegular;
+  static int16_t pendingShuntVoltage; // 10uV
+
+  static uint32_t pendingTriggerTime; // us
+
+  // Regular sample waiting for the bus
+  static struct {
+    uint32_t timestamp;
+    uint32_t time; // us
+    bool isPending:1;
+    bool isLate:1;
+    bool isReading:1; // previous sample still on the bus
+  } trigger = {0, 0, false, false, false};
+
+  static volatile uint16_t lateSamples = 0;
+  static volatile uint16_t droppedSamples = 0;
+  // From sample tick to both registers read, us
+  static volatile uint16_t lastLatency = 0;
+  static volatile uint16_t maxLatency = 0;
+
+  // busVoltage is register value, 4mV starting from bit 3
+  static Sample calibrate(int16_t shuntVoltage, uint16_t busVoltage) {
+    int32_t amperage = GaugeCalibration::toAmperage(shuntVoltage);
+    int32_t voltage = GaugeCalibration::toVoltage((busVoltage >> 3) * 4, amperage);
+    return {pendingTimestamp, (uint16_t) amperage, (uint16_t) voltage, pendingCaptureTag, isPendingRegular};
   }
 
-  void makeMeasurement() {
-    float amperage = ina219.getShuntVoltage_mV() * 60;
-    if (amperage < NOICE_AMPERAGE) {
-      amperage = 0;
-    } else if (amperage < 3778) {
-      amperage += amperage * 0.009;
-    } else if (amperage < 6091) {
-      amperage += 34;
+  static void onBusVoltageRead(bool success, uint16_t value) {
+    trigger.isReading = false;
+    if (success) {
+      if (value >= TRIP_BUS_VOLTAGE) {
+        EmergencyManager::trip(EmergencyManager::OverVoltage, pendingTriggerTime);
+      }
+      lastLatency = min(micros() - pendingTriggerTime, 0xFFFFUL);
+      maxLatency = max(maxLatency, lastLatency);
+      Sample sample = calibrate(pendingShuntVoltage, value);
+      if (!samples.push(sample)) {
+        ++droppedSamples; // loop() did not take samples in time
+      }
+      if (sample.isRegular) {
+        RawCapture::addSample(sample.timestamp, sample.amperage, sample.voltage);
+      }
     } else {
-      amperage += -0,011 * amperage + 101;
+      ++droppedSamples;
     }
-    
-    int32_t voltage = ina219.getBusVoltage_V() * 1000;
-    if (voltage < NOISE_VOLTAGE) {
-      voltage = 0;
+  }
+
+  static void onShuntVoltageRead(bool success, uint16_t value) {
+    if (success) {
+      if ((int16_t) value >= TRIP_SHUNT_VOLTAGE) {
+        EmergencyManager::trip(EmergencyManager::OverCurrent, pendingTriggerTime);
+      }
+      pendingShuntVoltage = value;
+      if (I2cBus::startReadRegister(INA219_I2C_ADDRESS, INA219_REG_BUSVOLTAGE, onBusVoltageRead)) {
+        return;
+      }
+    }
+    trigger.isReading = false;
+    ++droppedSamples;
+  }
+
+  // Edge capture is of use only at its own tick. It shares the read with a
+  // regular sample due at the same time, or is skipped if the bus is busy
+  // and TransientLoad repeats its offset later.
+  void startMeasurement(uint32_t timestamp, bool isSampleTick, uint8_t captureTag) {
+    if (isSampleTick) {
+      if (trigger.isPending) {
+        ++droppedSamples; // bus was not free for the whole sample period
+      }
+      trigger.timestamp = timestamp;
+      trigger.time = micros();
+      trigger.isPending = true;
+      trigger.isLate = false;
+    } else if (trigger.isPending) {
+      trigger.isLate = true;
+    } else if (captureTag == TransientLoad::NO_CAPTURE) {
+      return;
+    }
+
+    if (trigger.isReading
+        || !I2cBus::startReadRegister(INA219_I2C_ADDRESS, INA219_REG_SHUNTVOLTAGE, onShuntVoltageRead)) {
+      return;
+    }
+    trigger.isReading = true;
+    pendingCaptureTag = captureTag;
+    isPendingRegular = trigger.isPending;
+    if (trigger.isPending) {
+      pendingTimestamp = trigger.timestamp;
+      pendingTriggerTime = trigger.time;
+      trigger.isPending = false;
+      if (trigger.isLate) {
+        ++lateSamples;
+      }
     } else {
-      voltage += (-27 * voltage + 430000) / 10000;
-      voltage += amperage * 24 / 1000;
+      pendingTimestamp = timestamp;
+      pendingTriggerTime = micros();
     }
-    
-    
-    SystemState::setAmperage(amperage);
-    SystemState::setVoltage(voltage);
+  }
+
+  uint16_t getLateSamples() {
+    uint16_t count;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      count = lateSamples;
+    }
+    return count;
+  }
+
+  uint16_t getDroppedSamples() {
+    uint16_t count;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      count = droppedSamples;
+    }
+    return count;
+  }
+
+  uint16_t getLastLatency() {
+    uint16_t latency;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      latency = lastLatency;
+    }
+    return latency;
+  }
+
+  uint16_t getMaxLatency() {
+    uint16_t latency;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      latency = maxLatency;
+    }
+    return latency;
+  }
+
+  void resetMaxLatency() {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      maxLatency = 0;
+    }
+  }
+
+  void setup() {
+    I2cBus::setup();
+    I2cBus::writeRegister(INA219_I2C_ADDRESS, INA219_REG_CONFIG, INA219_CONFIG);
+  }
+
+  void makeMeasurement() {
+    Sample sample;
+    while (samples.pop(sample)) {
+      if (sample.captureTag != TransientLoad::NO_CAPTURE) {
+        TransientLoad::addEdgeSample(sample.captureTag, sample.voltage);
+      }
+      // Edge captures bunch up after the edges and would skew the averages
+      if (!sample.isRegular) {
+        continue;
+      }
+      SystemState::setMeasurement(sample.timestamp, sample.amperage, sample.voltage);
+      Telemetry::sendSample(sample.timestamp, sample.amperage, sample.voltage);
+    }
+  }
+};
+
+
+namespace RawCapture {
+  // Interrupt fills one buffer while loop() writes the other to SD card
+  static BinaryLog::RawRecord buffers[2][RAW_CAPTURE_BUFFER_RECORDS];
+  static volatile uint8_t bufferLength[2] = {0, 0}; // non zero once full
+  static volatile uint8_t fillingBuffer = 0;
+  static volatile uint8_t fillLevel = 0;
+  static uint8_t writingBuffer = 0; // buffers are filled and written in turns
+  static volatile uint32_t overrunRecords = 0;
+  static volatile bool isEnabled = false;
+
+  static void handOverFillingBuffer() {
+    bufferLength[fillingBuffer] = fillLevel;
+    fillingBuffer ^= 1;
+    fillLevel = 0;
+  }
+
+  void addSample(uint32_t timestamp, uint16_t amperage, uint16_t voltage) {
+    if (!isEnabled) {
+      return;
+    }
+    if (bufferLength[fillingBuffer] != 0) {
+      ++overrunRecords; // SD card is behind, both buffers are full
+      return;
+    }
+    buffers[fillingBuffer][fillLevel++] = {timestamp, amperage, voltage};
+    if (fillLevel == RAW_CAPTURE_BUFFER_RECORDS) {
+      handOverFillingBuffer();
+    }
+  }
+
+  void setEnabled(bool value) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      if (isEnabled && !value && fillLevel != 0) {
+        handOverFillingBuffer();
+      }
+      isEnabled = value;
+    }
+  }
+
+  bool getFullBuffer(const BinaryLog::RawRecord *&records, uint8_t &length) {
+    length = bufferLength[writingBuffer];
+    records = buffers[writingBuffer];
+    return length != 0;
+  }
+
+  void releaseFullBuffer() {
+    bufferLength[writingBuffer] = 0;
+    writingBuffer ^= 1;
+  }
+
+  uint32_t getOverrunRecords() {
+    uint32_t count;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      count = overrunRecords;
+    }
+    return count;
+  }
+
+  void resetOverrunRecords() {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      overrunRecords = 0;
+    }
+  }
+};
+
+
+namespace TransientLoad {
+  static const uint8_t MIN_TICKS_BETWEEN_CAPTURES = SAMPLE_TICK_HZ / SAMPLE_RATE_HZ;
+  static const uint8_t PHASE_BIT = 0x80; // capture tag is phase bit and offset
+  static const uint16_t TICK_US = 1000000UL / SAMPLE_TICK_HZ;
+  // Bus voltage is the second of two register reads started on the tick
+  static const uint16_t BUS_READ_DELAY_US = 2 * (2 + 9 * 5) * 1000000UL / I2C_CLOCK_HZ;
+  // Read returns the last bus conversion, it ended 0..2 conversions before
+  // and averaged the conversion before that: on average 1.5 conversions
+  // back, give or take one conversion with the random phase
+  static const uint16_t BUS_READING_AGE_US = 3 * INA219_CONVERSION_US / 2;
+
+  // Written by loop() while stopped, phase 0 is low and 1 is high amperage
+  static int16_t dutyCycles[2];
+  static uint8_t phaseTicks[2];
+  static volatile bool isEnabled = false;
+
+  // Interrupt side
+  static uint8_t phase;
+  static uint8_t phaseTick; // 0 is the tick OCR1B was written, new level starts on the next one
+  static uint8_t captureOffsets[2];
+  static uint8_t ticksSinceCapture;
+
+  // loop() side, offset 0 is the last sample before the edge
+  static uint16_t responses[2][TRANSIENT_CAPTURE_TICKS];
+  static uint16_t capturedOffsets[2];
+  static EdgeResponse edgeResponses[2];
+  static bool isEdgeResponseReady[2];
+
+  static uint8_t getCaptureWindow(uint8_t capturePhase) {
+    return min(phaseTicks[capturePhase], TRANSIENT_CAPTURE_TICKS);
+  }
+
+  void start(int16_t lowDutyCycle, int16_t highDutyCycle, uint8_t lowTicks, uint8_t highTicks) {
+    stop();
+    dutyCycles[0] = lowDutyCycle;
+    dutyCycles[1] = highDutyCycle;
+    phaseTicks[0] = lowTicks;
+    phaseTicks[1] = highTicks;
+    phase = 0;
+    phaseTick = 0;
+    captureOffsets[0] = captureOffsets[1] = 0;
+    ticksSinceCapture = 0;
+    capturedOffsets[0] = capturedOffsets[1] = 0;
+    isEdgeResponseReady[0] = isEdgeResponseReady[1] = false;
+    OCR1B = lowDutyCycle;
+    isEnabled = true;
+  }
+
+  void stop() {
+    isEnabled = false;
+  }
+
+  bool isRunning() {
+    return isEnabled;
+  }
+
+  void tick(uint8_t &captureTag) {
+    captureTag = NO_CAPTURE;
+    if (!isEnabled) {
+      return;
+    }
+    if (++phaseTick >= phaseTicks[phase]) {
+      // Fast pwm latches OCR1B at the end of the period, edge timing is exact
+      phase ^= 1;
+      phaseTick = 0;
+      OCR1B = dutyCycles[phase];
+    }
+    if (ticksSinceCapture < MIN_TICKS_BETWEEN_CAPTURES) {
+      ++ticksSinceCapture;
+    }
+    // Offset 0 catches the old level right before the edge takes effect
+    if (phaseTick == captureOffsets[phase] && ticksSinceCapture >= MIN_TICKS_BETWEEN_CAPTURES) {
+      captureTag = (phase ? PHASE_BIT : 0) | phaseTick;
+      ticksSinceCapture = 0;
+      if (++captureOffsets[phase] >= getCaptureWindow(phase)) {
+        captureOffsets[phase] = 0;
+      }
+    }
+  }
+
+  static void analyzeEdge(uint8_t edge) {
+    const uint16_t *response = responses[edge];
+    uint8_t window = getCaptureWindow(edge);
+    EdgeResponse &result = edgeResponses[edge];
+    result.preEdgeVoltage = response[0];
+    result.settledVoltage = response[window - 1];
+    result.deviation = 0;
+    uint8_t lastDeviatingOffset = 0;
+    for (uint8_t offset = 1; offset < window; ++offset) {
+      uint16_t deviation = abs((int32_t) response[offset] - result.settledVoltage);
+      result.deviation = max(result.deviation, deviation);
+      if (deviation > TRANSIENT_SETTLE_TOLERANCE_MV) {
+        lastDeviatingOffset = offset;
+      }
+    }
+    // New level starts at offset 1, offset reading describes the bus
+    // BUS_READING_AGE_US before its read. Voltage settled between the last
+    // deviating reading and the next one, take the middle
+    int32_t recoveryTime = (int32_t) (lastDeviatingOffset - 1) * TICK_US + TICK_US / 2
+        + BUS_READ_DELAY_US - BUS_READING_AGE_US;
+    result.recoveryTime = recoveryTime > 0 ? recoveryTime : 0;
+    result.recoveryUncertainty = TICK_US / 2 + INA219_CONVERSION_US;
+    isEdgeResponseReady[edge] = true;
+  }
+
+  void addEdgeSample(uint8_t captureTag, uint16_t voltage) {
+    uint8_t edge = captureTag & PHASE_BIT ? 1 : 0;
+    uint8_t offset = captureTag & ~PHASE_BIT;
+    uint8_t window = getCaptureWindow(edge);
+    if (!isEnabled || offset >= window) {
+      return;
+    }
+    responses[edge][offset] = voltage;
+    capturedOffsets[edge] |= 1 << offset;
+    if (capturedOffsets[edge] == (uint16_t) ((1UL << window) - 1)) {
+      analyzeEdge(edge);
+      capturedOffsets[edge] = 0;
+    }
+  }
+
+  bool getEdgeResponse(bool isRisingEdge, EdgeResponse &response) {
+    uint8_t edge = isRisingEdge ? 1 : 0;
+    response = edgeResponses[edge];
+    return isEdgeResponseReady[edge];
+  }
+};
+
+
+namespace AcquisitionScheduler {
+  static_assert(SAMPLE_TICK_HZ % SAMPLE_RATE_HZ == 0, "Sample rate should divide timer tick rate");
+  static const uint8_t TICKS_PER_SAMPLE = SAMPLE_TICK_HZ / SAMPLE_RATE_HZ;
+
+  static uint8_t tickCounter = 0;
+  static uint8_t sampleTick = 0; // within the sample period
+  static uint16_t ditherState = 1; // xorshift
+
+  void tick() {
+    if (++tickCounter >= TICKS_PER_SAMPLE) {
+      tickCounter = 0;
+      // Transient edges are on the same tick grid, samples at a fixed tick
+      // would see the same few points of the waveform over and over
+      if (TransientLoad::isRunning()) {
+        ditherState ^= ditherState << 7;
+        ditherState ^= ditherState >> 9;
+        ditherState ^= ditherState << 8;
+        sampleTick = ditherState % TICKS_PER_SAMPLE;
+      } else {
+        sampleTick = 0;
+      }
+    }
+    bool isSampleTick = tickCounter == sampleTick;
+    // Transient load adds reads at offsets after its edges
+    uint8_t captureTag;
+    TransientLoad::tick(captureTag);
+    GaugeReader::startMeasurement(millis(), isSampleTick, captureTag);
   }
 };
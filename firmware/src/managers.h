@@ -1,10 +1,27 @@
 #pragma once
 
 #include "constants.h"
+#include "binary_log.h"
 
 namespace AmperagePinManager {
   void setup();
-  void tuneDischargeCurrent(bool isRefreshCycle);
+  // Regulates current to the target of SystemState::getLoadMode(), target
+  // is recomputed from instant voltage on every sample
+  void tuneDischargeCurrent();
+  uint16_t getTargetAmperage();
+
+  // DC internal resistance from IR_STEPS current steps on top of regulated
+  // current. Also runs every IR_MEASUREMENT_INTERVAL_MS while regulating.
+  void startResistanceMeasurement();
+  bool isMeasuringResistance();
+  uint16_t getInternalResistance(); // 0.1 mOhm, 0 if not measured yet
+
+  // Sweeps pwm duty cycle up to the desired amperage and stores measured
+  // currents as feed-forward table. Device should be on.
+  void startCalibration();
+  bool isCalibrating();
+  uint16_t getFeedForwardStep();
+  uint16_t getFeedForwardAmperage(uint8_t point);
 };
 
 
@@ -22,12 +39,23 @@ namespace EmergencyManager {
                    MosfetFault_4 | MosfetFault_5 | MosfetFault_6,
     OverVoltage = 1 << 7,
     StopVoltageReached = 1 << 8,
+    OverCurrent = 1 << 9,
   };
 
   void setup();
   void updateOnOffState();
   void reportAmperage(int mAmp, int channel);
 
+  // Called from gauge interrupt on a sample over TRIP_AMPERAGE or
+  // TRIP_VOLTAGE, cuts the load right away. Reason stays latched and keeps
+  // the load off until it is switched on again.
+  void trip(uint16_t reason, uint32_t sampleTime /* us, sample tick */);
+  // Raises emergency and switches device off after trip, every loop pass
+  void reportTrip();
+  uint16_t getTripReason();
+  uint16_t getTripLatency(); // us from sample tick to cut, last trip
+
+  uint16_t getEmergency();
   uint16_t getMainEmergency();
   const __FlashStringHelper *emergencyToString(uint16_t emergency);
 };
@@ -40,26 +68,92 @@ namespace FanManager {
 
 namespace FanTemperatureReader {
   void setup();
-  void makeMeasurement();
+  void addMeasurement(uint16_t value); // called from ADC interrupt
   void updateAverageTemperatureValue();
 };
 
 namespace SdCardLogger {
   void setup();
   void writeSystemState();
+  void writeRawCapture();
+  void flush();
 
   bool isFault();
   void printFileName(const Print &printer);
   void changeFile();
+
+  // Record writes and flushes since the last reset, us
+  struct WriteStats {
+    uint32_t maxWriteTime;
+    uint32_t totalWriteTime;
+    uint16_t writeCount;
+  };
+  const WriteStats &getWriteStats();
+  void resetWriteStats();
 };
 
+// Charge, energy, setpoints and load mode survive power loss
 namespace PersistenceStateManager {
   void setup();
+  // Starts writing a record if state changed, every few calls
   void preserve();
+  // Writes pending record bytes without waiting for EEPROM
+  void update();
 };
 
 
 namespace GaugeReader {
   void setup();
-  void makeMeasurement(); 
+  void startMeasurement(uint32_t timestamp, bool isSampleTick, uint8_t captureTag); // called from timer interrupt
+  void makeMeasurement();
+
+  uint16_t getLateSamples();
+  uint16_t getDroppedSamples();
+  // Time from sample tick until sample is read, us
+  uint16_t getLastLatency();
+  uint16_t getMaxLatency();
+  void resetMaxLatency();
+};
+
+namespace RawCapture {
+  // Called from TWI interrupt
+  void addSample(uint32_t timestamp, uint16_t amperage, uint16_t voltage);
+  // Disabling hands partially filled buffer over to the logger
+  void setEnabled(bool value);
+  bool getFullBuffer(const BinaryLog::RawRecord *&records, uint8_t &length);
+  void releaseFullBuffer();
+  uint32_t getOverrunRecords();
+  void resetOverrunRecords();
+};
+
+// Square wave between transient low amperage and desired amperage for power
+// supply transient tests. Timer interrupt switches OCR1B, so edges land
+// exactly on pwm period boundaries. Every period one extra gauge read is
+// taken at the next offset after the edge, so edge response is rebuilt over
+// several periods. Regular samples go on as usual.
+namespace TransientLoad {
+  static const uint8_t NO_CAPTURE = 0xFF;
+
+  struct EdgeResponse {
+    uint16_t preEdgeVoltage; // mV, right before the edge
+    uint16_t settledVoltage; // mV, at the end of capture window
+    uint16_t deviation; // mV, largest distance from settled voltage
+    uint16_t recoveryTime; // us from the edge until voltage stays within tolerance
+    // us, recovery is +- this from tick spacing and INA219 conversion
+    // phase, reading noise close to the tolerance comes on top
+    uint16_t recoveryUncertainty;
+  };
+
+  void start(int16_t lowDutyCycle, int16_t highDutyCycle, uint8_t lowTicks, uint8_t highTicks);
+  void stop();
+  bool isRunning();
+  // Called from timer interrupt, captureTag is NO_CAPTURE unless gauge
+  // should read at this tick
+  void tick(uint8_t &captureTag);
+  void addEdgeSample(uint8_t captureTag, uint16_t voltage);
+  bool getEdgeResponse(bool isRisingEdge, EdgeResponse &response);
+};
+
+namespace AcquisitionScheduler {
+  void tick(); // called from timer interrupt every 1ms
 };
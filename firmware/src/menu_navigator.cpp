@@ -1,29 +1,133 @@
-#include <SSD1306AsciiWire.h>
+#include <SSD1306AsciiAvrI2c.h>
 #include <ClickEncoder.h>
 
 #include "menu_navigator.h"
 #include "custom_menu.h"
+#include "display_frame.h"
 #include "system_state.h"
+#include "managers.h"
+#include "profiler.h"
 
-MenuNavigator::MenuNavigator(ClickEncoder &encoder, SSD1306AsciiWire &oled) : 
+MenuNavigator::MenuNavigator(ClickEncoder &encoder, SSD1306AsciiAvrI2c &oled) : 
     encoder(encoder), oled(oled) {}
 
 
 void MenuNavigator::processInput() {
   int16_t encoderValue = encoder.getValue();
+  ClickEncoder::Button button = encoder.getButton();
+  // Held repeats until release, act on its first report only
+  bool isHoldRepeat = button == ClickEncoder::Held && isButtonHeld;
+  isButtonHeld = button == ClickEncoder::Held;
+  if (isHoldRepeat) {
+    button = ClickEncoder::Closed;
+  }
+#if PROFILER_ENABLED
+  if (isProfilerShown) {
+    processProfilerInput(encoderValue, button);
+    return;
+  }
+#endif
   if (encoderValue != 0) {
     topMenu.processMoveEvent(encoderValue);
   }
-  ClickEncoder::Button button = encoder.getButton();
   if (button == ClickEncoder::Clicked) {
     topMenu.processEnterEvent();
   } else if (button == ClickEncoder::DoubleClicked) {
     topMenu.processEnterEvent();
     topMenu.processEnterEvent();
+  } else if (button == ClickEncoder::Held) {
+#if PROFILER_ENABLED
+    if (!SystemState::getDeviceStatusIsOn()) {
+      isProfilerShown = true;
+      profilerPaintTime = millis() - REFRESH_INTERVAL_MS;
+      return;
+    }
+#endif
+    AmperagePinManager::startCalibration();
   }
 }
 
 void MenuNavigator::updateOutput() {
-  CustomMenuPrintContext context = {oled, SystemState::isFirstLoop()};
+#if PROFILER_ENABLED
+  if (isProfilerShown) {
+    printProfilerPage();
+    return;
+  }
+#endif
+  CustomMenuPrintContext context = {displayFrame, SystemState::isFirstLoop() || isFullPaintNeeded};
+  if (isFullPaintNeeded) {
+    displayFrame.clear();
+    isFullPaintNeeded = false;
+  }
   topMenu.print(context);
+  displayFrame.render(oled);
+}
+
+#if PROFILER_ENABLED
+// Encoder selects stage, click resets statistics, hold returns to menu
+void MenuNavigator::processProfilerInput(int16_t encoderValue, uint8_t button) {
+  if (encoderValue != 0) {
+    profilerStage = (profilerStage + Profiler::StageCount + encoderValue % Profiler::StageCount) % Profiler::StageCount;
+  }
+  if (button == ClickEncoder::Clicked) {
+    Profiler::reset();
+  } else if (button == ClickEncoder::Held) {
+    isProfilerShown = false;
+    isFullPaintNeeded = true;
+    return;
+  } else if (encoderValue == 0) {
+    return;
+  }
+  profilerPaintTime = millis() - REFRESH_INTERVAL_MS;
+}
+
+// Stage name and count, min/mean/max in us, then histogram buckets as
+// "bucket:count", three per row
+void MenuNavigator::printProfilerPage() {
+  uint32_t now = millis();
+  if (now - profilerPaintTime < REFRESH_INTERVAL_MS) {
+    return;
+  }
+  profilerPaintTime = now;
+
+  Profiler::Stage stage = (Profiler::Stage) profilerStage;
+  const Profiler::StageStats &stats = Profiler::getStats(stage);
+  displayFrame.setCursor(0, 0);
+  displayFrame.print(Profiler::getStageName(stage));
+  displayFrame.print(' ');
+  displayFrame.print(stats.count);
+  displayFrame.clearToEOL();
+  displayFrame.setCursor(0, 1);
+  displayFrame.print(stats.minTime);
+  displayFrame.print('/');
+  displayFrame.print(Profiler::getMeanTime(stage));
+  displayFrame.print('/');
+  displayFrame.print(stats.maxTime);
+  displayFrame.print(F("us"));
+  displayFrame.clearToEOL();
+  for (uint8_t i = 0; i < PROFILER_HISTOGRAM_BUCKETS; ++i) {
+    if (i % 3 == 0) {
+      if (i != 0) {
+        displayFrame.clearToEOL();
+      }
+      displayFrame.setCursor(0, 2 + i / 3);
+    } else {
+      displayFrame.print(' ');
+    }
+    if (i < 10) {
+      displayFrame.print(' ');
+    }
+    displayFrame.print(i);
+    displayFrame.print(':');
+    displayFrame.print(stats.histogram[i]);
+    if (stats.histogram[i] < 100) {
+      displayFrame.print(' ');
+    }
+    if (stats.histogram[i] < 10) {
+      displayFrame.print(' ');
+    }
+  }
+  displayFrame.clearToEOL();
+  displayFrame.render(oled);
 }
+#endif
@@ -1,14 +1,23 @@
 #pragma once
 
 class ClickEncoder;
-class SSD1306AsciiWire;
+class SSD1306AsciiAvrI2c;
 
 
 class MenuNavigator {
   const ClickEncoder &encoder;
-  SSD1306AsciiWire &oled;
+  SSD1306AsciiAvrI2c &oled;
+  // Hidden profiler page replaces menu while shown
+  bool isProfilerShown = false;
+  bool isFullPaintNeeded = false;
+  bool isButtonHeld = false;
+  uint8_t profilerStage = 0;
+  uint32_t profilerPaintTime = 0;
 public:
-  MenuNavigator(ClickEncoder &encoder, SSD1306AsciiWire &oled);
+  MenuNavigator(ClickEncoder &encoder, SSD1306AsciiAvrI2c &oled);
   void processInput();
   void updateOutput();
+private:
+  void processProfilerInput(int16_t encoderValue, uint8_t button);
+  void printProfilerPage();
 };
@@ -0,0 +1,108 @@
+#include <Arduino.h>
+
+#include "profiler.h"
+
+#if PROFILER_ENABLED
+
+namespace Profiler {
+  static StageStats stats[StageCount];
+
+  static const char INPUT_NAME[] PROGMEM = "input";
+  static const char GAUGE_NAME[] PROGMEM = "gauge";
+  static const char THERMISTOR_NAME[] PROGMEM = "thermo";
+  static const char AVERAGE_NAME[] PROGMEM = "average";
+  static const char EMERGENCY_NAME[] PROGMEM = "emerg";
+  static const char REGULATION_NAME[] PROGMEM = "regul";
+  static const char DISPLAY_NAME[] PROGMEM = "display";
+  static const char SD_CARD_NAME[] PROGMEM = "sdcard";
+  static const char PERSISTENCE_NAME[] PROGMEM = "eeprom";
+
+  static const char * const STAGE_NAMES[StageCount] PROGMEM = {
+    INPUT_NAME,
+    GAUGE_NAME,
+    THERMISTOR_NAME,
+    AVERAGE_NAME,
+    EMERGENCY_NAME,
+    REGULATION_NAME,
+    DISPLAY_NAME,
+    SD_CARD_NAME,
+    PERSISTENCE_NAME,
+  };
+
+  static uint8_t getBucket(uint32_t time) {
+    uint8_t bucket = 0;
+    for (time >>= 2; time != 0 && bucket < PROFILER_HISTOGRAM_BUCKETS - 1; time >>= 1) {
+      ++bucket;
+    }
+    return bucket;
+  }
+
+  void addSample(Stage stage, uint32_t time) {
+    StageStats &stageStats = stats[stage];
+    uint16_t savedTime = min(time, (uint32_t) UINT16_MAX);
+    if (stageStats.count == 0 || savedTime < stageStats.minTime) {
+      stageStats.minTime = savedTime;
+    }
+    if (savedTime > stageStats.maxTime) {
+      stageStats.maxTime = savedTime;
+    }
+
+    if (stageStats.count == UINT16_MAX || stageStats.totalTime > UINT32_MAX - time) {
+      stageStats.count >>= 1;
+      stageStats.totalTime >>= 1;
+    }
+    ++stageStats.count;
+    stageStats.totalTime += time;
+
+    uint8_t &bucket = stageStats.histogram[getBucket(time)];
+    if (bucket == UINT8_MAX) {
+      for (uint8_t i = 0; i < PROFILER_HISTOGRAM_BUCKETS; ++i) {
+        stageStats.histogram[i] >>= 1;
+      }
+    }
+    ++bucket;
+  }
+
+  const StageStats &getStats(Stage stage) {
+    return stats[stage];
+  }
+
+  uint16_t getMeanTime(Stage stage) {
+    const StageStats &stageStats = stats[stage];
+    return stageStats.count ? min(stageStats.totalTime / stageStats.count, (uint32_t) UINT16_MAX) : 0;
+  }
+
+  const __FlashStringHelper *getStageName(Stage stage) {
+    return (const __FlashStringHelper *) pgm_read_ptr(&STAGE_NAMES[stage]);
+  }
+
+  bool printStats(Print &output, Stage stage, uint8_t part) {
+    static const uint8_t BUCKETS_PER_PART = 8;
+    const StageStats &stageStats = stats[stage];
+    if (part == 0) {
+      output.print(getStageName(stage));
+      output.print(' ');
+      output.print(stageStats.count);
+      output.print(' ');
+      output.print(stageStats.minTime);
+      output.print(' ');
+      output.print(getMeanTime(stage));
+      output.print(' ');
+      output.print(stageStats.maxTime);
+      return true;
+    }
+    uint8_t first = (part - 1) * BUCKETS_PER_PART;
+    uint8_t end = min(first + BUCKETS_PER_PART, PROFILER_HISTOGRAM_BUCKETS);
+    for (uint8_t i = first; i < end; ++i) {
+      output.print(' ');
+      output.print(stageStats.histogram[i]);
+    }
+    return end < PROFILER_HISTOGRAM_BUCKETS;
+  }
+
+  void reset() {
+    memset(stats, 0, sizeof(stats));
+  }
+};
+
+#endif
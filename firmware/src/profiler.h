@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "constants.h"
+
+class Print;
+
+// Execution time of main loop stages. Every stage keeps min, max, mean and
+// log2 histogram: bucket 0 counts times below 4us, bucket k times in
+// [2^(k+1), 2^(k+2)) us, the last bucket everything above. Counters are
+// halved when one of them saturates, so histogram keeps its shape.
+namespace Profiler {
+  enum Stage : uint8_t {
+    Input,
+    Gauge,
+    Thermistor,
+    Average,
+    Emergency,
+    Regulation,
+    Display,
+    SdCard,
+    Persistence,
+    StageCount
+  };
+
+  struct StageStats {
+    uint16_t minTime; // us, saturated
+    uint16_t maxTime; // us, saturated
+    uint32_t totalTime; // us
+    uint16_t count;
+    uint8_t histogram[PROFILER_HISTOGRAM_BUCKETS];
+  };
+
+#if PROFILER_ENABLED
+  void addSample(Stage stage, uint32_t time);
+  const StageStats &getStats(Stage stage);
+  uint16_t getMeanTime(Stage stage);
+  const __FlashStringHelper *getStageName(Stage stage);
+  // Single line "name count min mean max h0 .. h15" in parts of at most 40
+  // characters, returns false once the line is complete
+  bool printStats(Print &output, Stage stage, uint8_t part);
+  void reset();
+
+  // Times the enclosing scope
+  class Probe {
+    uint32_t startTime;
+    Stage stage;
+  public:
+    inline Probe(Stage stage) : startTime(micros()), stage(stage) {}
+    inline ~Probe() { addSample(stage, micros() - startTime); }
+  };
+#else
+  inline void addSample(Stage, uint32_t) {}
+  inline void reset() {}
+
+  struct Probe {
+    inline Probe(Stage) {}
+  };
+#endif
+};
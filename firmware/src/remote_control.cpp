@@ -0,0 +1,585 @@
+#include <Arduino.h>
+#include <ctype.h>
+
+#include "remote_control.h"
+
+#if REMOTE_CONTROL_ENABLED
+
+#include "system_state.h"
+#include "managers.h"
+#include "task_scheduler.h"
+#include "profiler.h"
+#include "display_frame.h"
+
+namespace RemoteControl {
+  typedef bool (*CommandHandler)(const char *argument);
+  // Prints part of a long reply, returns false after the last one
+  typedef bool (*ReplyPart)(uint8_t part);
+
+  struct Command {
+    char name[14];
+    CommandHandler handler;
+  };
+
+  static char line[REMOTE_CONTROL_LINE_LENGTH + 1];
+  static uint8_t lineLength = 0;
+  static bool isLineOverflow = false;
+
+  static ReplyPart pendingReply = nullptr;
+  static uint8_t replyPart = 0;
+  static uint8_t replyArgument = 0;
+
+  // Time when command that may change pwm was executed, zero if none
+  static uint32_t pendingCommandTime = 0;
+  static uint16_t lastLatency = 0;
+  static uint16_t maxLatency = 0;
+
+  static bool parseNumber(const char *argument, int32_t minValue, int32_t maxValue, int32_t &value) {
+    if (!argument) {
+      return false;
+    }
+    char *end;
+    value = strtol(argument, &end, 10);
+    return end != argument && *end == '\0' && value >= minValue && value <= maxValue;
+  }
+
+  // Returns true once nothing is left to send
+  static bool continueReply() {
+    while (pendingReply && Serial.availableForWrite() >= REMOTE_CONTROL_REPLY_PART) {
+      if (!pendingReply(replyPart++)) {
+        pendingReply = nullptr;
+      }
+    }
+    return !pendingReply;
+  }
+
+  static void startReply(ReplyPart reply, uint8_t argument = 0) {
+    pendingReply = reply;
+    replyPart = 0;
+    replyArgument = argument;
+    continueReply();
+  }
+
+  // Regulation runs on the flag even if command set the same value again
+  static void markPwmCommand() {
+    pendingCommandTime = micros() | 1;
+    SystemState::setChangeFlag(SystemState::ControlCommand);
+  }
+
+  static bool identify(const char *) {
+    Serial.println(F("ElectronicLoad,v1.1"));
+    return true;
+  }
+
+  static bool setCurrent(const char *argument) {
+    int32_t value;
+    if (!parseNumber(argument, 0, MAX_CURRENT_MA, value)) {
+      return false;
+    }
+    SystemState::setDesiredAmperage(value);
+    markPwmCommand();
+    return true;
+  }
+
+  static bool queryCurrent(const char *) {
+    Serial.println(SystemState::getDesiredAmperage());
+    return true;
+  }
+
+  static bool setStopVoltage(const char *argument) {
+    int32_t value;
+    if (!parseNumber(argument, 0, 32000, value)) {
+      return false;
+    }
+    SystemState::setStopVoltage(value);
+    return true;
+  }
+
+  static bool queryStopVoltage(const char *) {
+    Serial.println(SystemState::getStopVoltage());
+    return true;
+  }
+
+  static bool setOutput(const char *argument) {
+    if (!argument) {
+      return false;
+    }
+    bool isOn;
+    if (strcmp_P(argument, PSTR("ON")) == 0 || strcmp_P(argument, PSTR("1")) == 0) {
+      isOn = true;
+    } else if (strcmp_P(argument, PSTR("OFF")) == 0 || strcmp_P(argument, PSTR("0")) == 0) {
+      isOn = false;
+    } else {
+      return false;
+    }
+    SystemState::setDeviceStatusIsOn(isOn);
+    markPwmCommand();
+    return true;
+  }
+
+  static bool queryOutput(const char *) {
+    Serial.println(SystemState::getDeviceStatusIsOn() ? F("ON") : F("OFF"));
+    return true;
+  }
+
+  static bool setPower(const char *argument) {
+    int32_t value;
+    if (!parseNumber(argument, 0, MAX_POWER_MW, value)) {
+      return false;
+    }
+    SystemState::setDesiredPower(value);
+    markPwmCommand();
+    return true;
+  }
+
+  static bool queryPower(const char *) {
+    Serial.println(SystemState::getDesiredPower());
+    return true;
+  }
+
+  static bool setResistance(const char *argument) {
+    int32_t value;
+    if (!parseNumber(argument, 0, MAX_RESISTANCE_MOHM, value)) {
+      return false;
+    }
+    SystemState::setDesiredResistance(value);
+    markPwmCommand();
+    return true;
+  }
+
+  static bool queryResistance(const char *) {
+    Serial.println(SystemState::getDesiredResistance());
+    return true;
+  }
+
+  static bool setVoltage(const char *argument) {
+    int32_t value;
+    if (!parseNumber(argument, 0, 32000, value)) {
+      return false;
+    }
+    SystemState::setDesiredVoltage(value);
+    markPwmCommand();
+    return true;
+  }
+
+  static bool queryVoltage(const char *) {
+    Serial.println(SystemState::getDesiredVoltage());
+    return true;
+  }
+
+  // Indexed by SystemState::LoadMode
+  static const char modeNames[SystemState::LoadModeCount][5] PROGMEM = {"CURR", "POW", "RES", "VOLT", "TRAN"};
+
+  static bool setMode(const char *argument) {
+    if (!argument) {
+      return false;
+    }
+    for (uint8_t i = 0; i < SystemState::LoadModeCount; ++i) {
+      if (strcmp_P(argument, modeNames[i]) == 0) {
+        SystemState::setLoadMode((SystemState::LoadMode) i);
+        markPwmCommand();
+        return true;
+      }
+    }
+    return false;
+  }
+
+  static bool queryMode(const char *) {
+    Serial.println((const __FlashStringHelper *) modeNames[SystemState::getLoadMode()]);
+    return true;
+  }
+
+  static bool setTransientLow(const char *argument) {
+    int32_t value;
+    if (!parseNumber(argument, 0, MAX_CURRENT_MA, value)) {
+      return false;
+    }
+    SystemState::setTransientLowAmperage(value);
+    markPwmCommand();
+    return true;
+  }
+
+  static bool queryTransientLow(const char *) {
+    Serial.println(SystemState::getTransientLowAmperage());
+    return true;
+  }
+
+  static bool setTransientPeriod(const char *argument) {
+    int32_t value;
+    if (!parseNumber(argument, TRANSIENT_MIN_PERIOD_MS, 255, value)) {
+      return false;
+    }
+    SystemState::setTransientPeriod(value);
+    return true;
+  }
+
+  static bool queryTransientPeriod(const char *) {
+    Serial.println(SystemState::getTransientPeriod());
+    return true;
+  }
+
+  static bool setTransientDuty(const char *argument) {
+    int32_t value;
+    if (!parseNumber(argument, 1, 99, value)) {
+      return false;
+    }
+    SystemState::setTransientDuty(value);
+    return true;
+  }
+
+  static bool queryTransientDuty(const char *) {
+    Serial.println(SystemState::getTransientDuty());
+    return true;
+  }
+
+  // Rising edge, then falling one
+  static bool printEdgeResponse(uint8_t part) {
+    bool isRisingEdge = part == 0;
+    if (!isRisingEdge) {
+      Serial.print(',');
+    }
+    TransientLoad::EdgeResponse response;
+    if (!TransientLoad::getEdgeResponse(isRisingEdge, response)) {
+      Serial.print(F("NONE"));
+    } else {
+      Serial.print(response.preEdgeVoltage);
+      Serial.print(' ');
+      Serial.print(response.settledVoltage);
+      Serial.print(' ');
+      Serial.print(response.deviation);
+      Serial.print(' ');
+      Serial.print(response.recoveryTime);
+      Serial.print(' ');
+      Serial.print(response.recoveryUncertainty);
+    }
+    if (isRisingEdge) {
+      return true;
+    }
+    Serial.println();
+    return false;
+  }
+
+  static bool queryTransientResponse(const char *) {
+    startReply(printEdgeResponse);
+    return true;
+  }
+
+  static bool measureCurrent(const char *) {
+    Serial.println(SystemState::getAverageAmperage());
+    return true;
+  }
+
+  static bool measureVoltage(const char *) {
+    Serial.println(SystemState::getAverageVoltage());
+    return true;
+  }
+
+  static bool measurePower(const char *) {
+    Serial.println(SystemState::getAveragePower());
+    return true;
+  }
+
+  static bool measurePeak(const char *) {
+    Serial.print(SystemState::getMinAmperage());
+    Serial.print(' ');
+    Serial.print(SystemState::getMaxAmperage());
+    Serial.print(' ');
+    Serial.print(SystemState::getMinVoltage());
+    Serial.print(' ');
+    Serial.println(SystemState::getMaxVoltage());
+    return true;
+  }
+
+  static bool measureRipple(const char *) {
+    Serial.print(SystemState::getAmperageRipple());
+    Serial.print(' ');
+    Serial.println(SystemState::getVoltageRipple());
+    return true;
+  }
+
+  static bool measureTemperature(const char *) {
+    Serial.println(SystemState::getAverageTemperature());
+    return true;
+  }
+
+  static bool measureCharge(const char *) {
+    Serial.println(SystemState::getAverageCharge(), 1);
+    return true;
+  }
+
+  static bool measureEnergy(const char *) {
+    Serial.println(SystemState::getAverageEnergy(), 1);
+    return true;
+  }
+
+  static bool startResistanceMeasurement(const char *) {
+    AmperagePinManager::startResistanceMeasurement();
+    return true;
+  }
+
+  static bool measureResistance(const char *) {
+    uint16_t internalResistance = AmperagePinManager::getInternalResistance();
+    Serial.print(internalResistance / 10);
+    Serial.print('.');
+    Serial.println(internalResistance % 10);
+    return true;
+  }
+
+  static bool queryEmergency(const char *) {
+    Serial.println(EmergencyManager::getEmergency());
+    return true;
+  }
+
+  static bool queryLatency(const char *) {
+    Serial.print(lastLatency);
+    Serial.print(' ');
+    Serial.println(maxLatency);
+    maxLatency = 0;
+    return true;
+  }
+
+  // One task per part
+  static bool printTaskStats(uint8_t index) {
+    if (index == TaskScheduler::getTaskCount()) {
+      Serial.println();
+      TaskScheduler::resetStats();
+      return false;
+    }
+    TaskScheduler::Task task;
+    TaskScheduler::getTask(index, task);
+    const TaskScheduler::TaskStats &stats = TaskScheduler::getStats(index);
+    if (index != 0) {
+      Serial.print(' ');
+    }
+    Serial.print(task.name);
+    Serial.print(' ');
+    Serial.print(stats.worstExecutionTime);
+    Serial.print(' ');
+    Serial.print(stats.overruns);
+    Serial.print(' ');
+    Serial.print(stats.runs);
+    return true;
+  }
+
+  static bool queryTasks(const char *) {
+    startReply(printTaskStats);
+    return true;
+  }
+
+  static bool queryTrip(const char *) {
+    Serial.print(EmergencyManager::getTripReason());
+    Serial.print(' ');
+    Serial.println(EmergencyManager::getTripLatency());
+    return true;
+  }
+
+  static bool queryGaugeLatency(const char *) {
+    Serial.print(GaugeReader::getLastLatency());
+    Serial.print(' ');
+    Serial.println(GaugeReader::getMaxLatency());
+    GaugeReader::resetMaxLatency();
+    return true;
+  }
+
+  static bool queryDisplay(const char *) {
+    const DisplayFrame::Stats &stats = displayFrame.getStats();
+    Serial.print(stats.frames);
+    Serial.print(' ');
+    Serial.print(stats.lastBytes);
+    Serial.print(' ');
+    Serial.print(stats.maxBytes);
+    Serial.print(' ');
+    Serial.print(stats.lastTime);
+    Serial.print(' ');
+    Serial.print(stats.maxTime);
+    Serial.print(' ');
+    Serial.println(stats.totalBytes);
+    displayFrame.resetMaxStats();
+    return true;
+  }
+
+#if PROFILER_ENABLED
+  // One stage name per part
+  static bool printStageNames(uint8_t stage) {
+    if (stage == Profiler::StageCount) {
+      Serial.println();
+      return false;
+    }
+    if (stage != 0) {
+      Serial.print(' ');
+    }
+    Serial.print(Profiler::getStageName((Profiler::Stage) stage));
+    return true;
+  }
+
+  static bool printStageStats(uint8_t part) {
+    if (Profiler::printStats(Serial, (Profiler::Stage) replyArgument, part)) {
+      return true;
+    }
+    Serial.println();
+    return false;
+  }
+
+  static bool queryProfiler(const char *argument) {
+    if (!argument) {
+      startReply(printStageNames);
+      return true;
+    }
+    int32_t stage;
+    if (!parseNumber(argument, 0, Profiler::StageCount - 1, stage)) {
+      return false;
+    }
+    startReply(printStageStats, stage);
+    return true;
+  }
+
+  static bool resetProfiler(const char *) {
+    Profiler::reset();
+    return true;
+  }
+#endif
+
+  static bool queryLogFile(const char *) {
+    if (SdCardLogger::isFault()) {
+      Serial.println(F("NONE"));
+    } else {
+      SdCardLogger::printFileName(Serial);
+      Serial.println();
+    }
+    return true;
+  }
+
+  static bool queryLogStats(const char *) {
+    const SdCardLogger::WriteStats &stats = SdCardLogger::getWriteStats();
+    Serial.print(stats.writeCount);
+    Serial.print(' ');
+    Serial.print(stats.maxWriteTime);
+    Serial.print(' ');
+    Serial.println(stats.writeCount == 0 ? 0 : stats.totalWriteTime / stats.writeCount);
+    SdCardLogger::resetWriteStats();
+    return true;
+  }
+
+  static bool nextLogFile(const char *) {
+    SdCardLogger::changeFile();
+    SystemState::resetAverageChargeAndEnergy();
+    return true;
+  }
+
+  static const Command COMMANDS[] PROGMEM = {
+    {"*IDN?", identify},
+    {"CURR", setCurrent},
+    {"CURR?", queryCurrent},
+    {"VOLT:STOP", setStopVoltage},
+    {"VOLT:STOP?", queryStopVoltage},
+    {"POW", setPower},
+    {"POW?", queryPower},
+    {"RES", setResistance},
+    {"RES?", queryResistance},
+    {"VOLT", setVoltage},
+    {"VOLT?", queryVoltage},
+    {"OUTP", setOutput},
+    {"OUTP?", queryOutput},
+    {"MODE", setMode},
+    {"MODE?", queryMode},
+    {"TRAN:LOW", setTransientLow},
+    {"TRAN:LOW?", queryTransientLow},
+    {"TRAN:PER", setTransientPeriod},
+    {"TRAN:PER?", queryTransientPeriod},
+    {"TRAN:DUTY", setTransientDuty},
+    {"TRAN:DUTY?", queryTransientDuty},
+    {"TRAN:RESP?", queryTransientResponse},
+    {"MEAS:CURR?", measureCurrent},
+    {"MEAS:VOLT?", measureVoltage},
+    {"MEAS:POW?", measurePower},
+    {"MEAS:PEAK?", measurePeak},
+    {"MEAS:RIPP?", measureRipple},
+    {"MEAS:TEMP?", measureTemperature},
+    {"MEAS:CHAR?", measureCharge},
+    {"MEAS:ENER?", measureEnergy},
+    {"MEAS:IR", startResistanceMeasurement},
+    {"MEAS:IR?", measureResistance},
+    {"SYST:EMER?", queryEmergency},
+    {"SYST:LAT?", queryLatency},
+    {"SYST:TASK?", queryTasks},
+    {"SYST:I2C?", queryGaugeLatency},
+    {"SYST:TRIP?", queryTrip},
+    {"SYST:DISP?", queryDisplay},
+#if PROFILER_ENABLED
+    {"SYST:PROF?", queryProfiler},
+    {"SYST:PROF:RES", resetProfiler},
+#endif
+    {"LOG:FILE?", queryLogFile},
+    {"LOG:NEXT", nextLogFile},
+    {"LOG:STAT?", queryLogStats},
+  };
+
+  static void executeLine() {
+    char *argument = strchr(line, ' ');
+    if (argument) {
+      *argument++ = '\0';
+      while (*argument == ' ') {
+        ++argument;
+      }
+      if (*argument == '\0') {
+        argument = nullptr;
+      }
+    }
+    for (uint8_t i = 0; i < sizeof(COMMANDS) / sizeof(COMMANDS[0]); ++i) {
+      if (strcmp_P(line, COMMANDS[i].name) == 0) {
+        CommandHandler handler = (CommandHandler) pgm_read_ptr(&COMMANDS[i].handler);
+        if (!handler(argument)) {
+          Serial.println(F("ERR argument"));
+        }
+        return;
+      }
+    }
+    Serial.println(F("ERR command"));
+  }
+
+  void setup() {
+    lineLength = 0;
+    isLineOverflow = false;
+    pendingReply = nullptr;
+  }
+
+  void processCommands() {
+    if (!continueReply()) {
+      return;
+    }
+    // Bounded by receive buffer size, so loop time stays predictable
+    for (int available = Serial.available(); available > 0; --available) {
+      // Next line may answer right away, the rest waits in receive buffer
+      if (pendingReply || Serial.availableForWrite() < REMOTE_CONTROL_REPLY_PART) {
+        return;
+      }
+      char chr = Serial.read();
+      if (chr == '\n' || chr == '\r') {
+        if (isLineOverflow) {
+          Serial.println(F("ERR length"));
+        } else if (lineLength != 0) {
+          line[lineLength] = '\0';
+          executeLine();
+        }
+        lineLength = 0;
+        isLineOverflow = false;
+      } else if (lineLength < REMOTE_CONTROL_LINE_LENGTH) {
+        line[lineLength++] = toupper(chr);
+      } else {
+        isLineOverflow = true;
+      }
+    }
+  }
+
+  void updateLatency() {
+    if (pendingCommandTime == 0) {
+      return;
+    }
+    uint32_t latency = micros() - (pendingCommandTime & ~1UL);
+    lastLatency = min(latency, 0xFFFFUL);
+    maxLatency = max(maxLatency, lastLatency);
+    pendingCommandTime = 0;
+  }
+};
+
+#endif
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "constants.h"
+
+// Line based SCPI-like commands on Serial, one command per line. Set
+// commands are silent, queries answer with a single line, failures answer
+// with "ERR ..." line. Shares UART with telemetry, so only one of them is
+// available. Long replies are sent over several loop() passes, the next
+// command is read once the reply is out.
+//
+//   *IDN?                 identification
+//   CURR <mA> | CURR?     constant current setpoint
+//   POW <mW> | POW?       constant power setpoint
+//   RES <mOhm> | RES?     constant resistance setpoint
+//   VOLT <mV> | VOLT?     constant voltage setpoint
+//   VOLT:STOP <mV> | ?    stop voltage
+//   OUTP ON|OFF | OUTP?   load on/off
+//   MODE CURR|POW|RES|VOLT|TRAN | MODE?  load mode
+//   TRAN:LOW <mA> | ?     transient low level, high level is CURR
+//   TRAN:PER <ms> | ?     transient period, 2..255
+//   TRAN:DUTY <%> | ?     share of period at high level
+//   TRAN:RESP?            rising and falling edge response as "pre settled
+//                         deviation recovery uncertainty" in mV and us,
+//                         recovery is +- uncertainty
+//   MEAS:CURR? VOLT? POW? TEMP? CHAR? ENER?  averages (mA mV mW 0.1*C mAh mWh)
+//   MEAS:PEAK?            min and max current, min and max voltage of last second
+//   MEAS:RIPP?            RMS current and voltage ripple of last second (mA mV)
+//   MEAS:IR | MEAS:IR?    start internal resistance measurement, last result
+//                         in mOhm, 0.0 if not measured yet
+//   SYST:EMER?            emergency bits, see EmergencyManager::EmergencyType
+//   SYST:LAT?             last and max command to pwm latency in us, resets max
+//   SYST:TASK?            "name wcet overruns runs" per scheduler task, wcet
+//                         in us, resets all three
+//   SYST:I2C?             last and max gauge sample latency in us from sample
+//                         tick to both registers read, resets max
+//   SYST:TRIP?            latched fast trip reason (EmergencyType bits, 0 after
+//                         load is switched on) and last trip latency in us
+//                         from sample tick to load cut
+//   SYST:DISP?            "frames bytes maxbytes us maxus totalbytes" of
+//                         display renders that sent anything, resets max
+//   SYST:PROF? [<stage>]  profiled stage names, or "name count min mean max
+//                         h0 .. h15" of stage by index, see profiler.h
+//   SYST:PROF:RES         reset profiler statistics
+//   LOG:FILE? | LOG:NEXT  log file name, start new log file
+//   LOG:STAT?             "writes max mean" of SD card record writes and
+//                         flushes, times in us, resets all three
+namespace RemoteControl {
+#if REMOTE_CONTROL_ENABLED
+  void setup();
+  // Parses bytes already received, never waits for more
+  void processCommands();
+  // Call after AmperagePinManager::tuneDischargeCurrent()
+  void updateLatency();
+#else
+  inline void setup() {}
+  inline void processCommands() {}
+  inline void updateLatency() {}
+#endif
+};
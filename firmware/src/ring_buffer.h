@@ -0,0 +1,45 @@
+#pragma once
+
+// Lock-free single producer / single consumer queue. Producer is usually an
+// interrupt handler and consumer is loop(). Indexes are single bytes so
+// reading and writing them is atomic on AVR.
+template<typename ValueType, uint8_t Size>
+struct RingBuffer {
+  static_assert((Size & (Size - 1)) == 0, "Size should be power of 2");
+
+  ValueType items[Size];
+  volatile uint8_t head = 0;
+  volatile uint8_t tail = 0;
+  volatile uint8_t overflowCounter = 0;
+
+  bool push(const ValueType &val) {
+    uint8_t currentHead = head;
+    if ((uint8_t)(currentHead - tail) >= Size) {
+      ++overflowCounter;
+      return false;
+    }
+    items[currentHead & (Size - 1)] = val;
+    asm volatile("" ::: "memory"); // item should be stored before head moves
+    head = currentHead + 1;
+    return true;
+  }
+
+  bool pop(ValueType &val) {
+    uint8_t currentTail = tail;
+    if (currentTail == head) {
+      return false;
+    }
+    val = items[currentTail & (Size - 1)];
+    asm volatile("" ::: "memory"); // item should be read before tail moves
+    tail = currentTail + 1;
+    return true;
+  }
+
+  uint8_t getFreeSpace() {
+    return Size - (uint8_t)(head - tail);
+  }
+
+  bool isEmpty() {
+    return head == tail;
+  }
+};
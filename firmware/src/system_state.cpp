@@ -4,70 +4,174 @@
 #include "average.h"
 
 namespace SystemState {
+  // Trapezoidal integral over every gauge sample with its own time step.
+  // Sums are 48 bit fixed point, 32 bit whole part and 16 bit fraction, so
+  // AVR never does 64 bit math. mAh and mWh are converted when read after
+  // a change.
   struct ElectricPowerValueAccumulator {
-    uint64_t chargeAccumulator = 0; /* mA*ms */
-    uint64_t powerAccumulator = 0; /* mA * mV * ms */
-  
-    inline void addMeasurement(uint16_t averageAmperage /* mA */,
-                               uint32_t averageVoltage /*mV*/,
-                               uint32_t deltaTime /* ms */) {
-      chargeAccumulator += (uint64_t) averageAmperage * deltaTime;
-      powerAccumulator += (uint64_t) averageAmperage * averageVoltage * deltaTime;
+    // mA*mV to 64uW units, so sample area at full power fits 32 bits
+    static const uint8_t POWER_SHIFT = 6;
+    static const uint8_t MAX_TIME_STEP = 255; // ms, longer gaps go in steps
+    // Sums keep both trapezoid sides, 0.5mA*ms and 32uW*ms per raw unit
+    static constexpr float RAW_PER_CHARGE = 7.2e6; // per mAh
+    static constexpr float RAW_PER_ENERGY = 1.125e8; // per mWh
+
+    struct Integral {
+      uint32_t whole = 0; // 65536 raw units
+      uint16_t fraction = 0;
+
+      inline void add(uint32_t value) {
+        uint32_t sum = (uint32_t) fraction + (value & 0xFFFF);
+        fraction = sum;
+        whole += (value >> 16) + (sum >> 16);
+      }
+
+      inline float get(float rawPerUnit) {
+        return (whole * 65536.0f + fraction) / rawPerUnit;
+      }
+
+      inline void set(float value, float rawPerUnit) {
+        float raw = value * rawPerUnit;
+        whole = raw / 65536.0f;
+        fraction = raw - whole * 65536.0f;
+      }
+    };
+
+    Integral chargeIntegral;
+    Integral energyIntegral;
+    float charge = 0; // mA*h
+    float energy = 0; // mW*h
+    uint32_t lastTime = 0; // ms
+    uint32_t lastPower = 0; // 64uW
+    uint16_t lastAmperage = 0; // mA
+    uint8_t powerRemainder = 0; // below 64uW, carried so small powers add up
+    uint16_t change = 0; // flags since takeChange()
+    bool hasLastSample:1;
+    bool isChargeCached:1;
+    bool isEnergyCached:1;
+
+    ElectricPowerValueAccumulator() : hasLastSample(false), isChargeCached(true), isEnergyCached(true) {}
+
+    inline void addMeasurement(uint32_t time /* ms */,
+                               uint16_t amperage /* mA */,
+                               uint32_t voltage /* mV */) {
+      uint32_t fullPower = (uint32_t) amperage * voltage + powerRemainder;
+      uint32_t power = fullPower >> POWER_SHIFT;
+      powerRemainder = fullPower & ((1 << POWER_SHIFT) - 1);
+      if (hasLastSample) {
+        uint32_t amperageSum = (uint32_t) amperage + lastAmperage;
+        uint32_t powerSum = power + lastPower;
+        uint32_t timePassed = time - lastTime;
+        if (timePassed != 0 && amperageSum != 0) {
+          isChargeCached = false;
+          change |= AverageCharge;
+          if (powerSum != 0) {
+            isEnergyCached = false;
+            change |= AverageEnergy;
+          }
+        }
+        while (timePassed != 0 && amperageSum != 0) {
+          uint8_t step = min(timePassed, (uint32_t) MAX_TIME_STEP);
+          chargeIntegral.add(amperageSum * step);
+          energyIntegral.add(powerSum * step);
+          timePassed -= step;
+        }
+      }
+      lastTime = time;
+      lastAmperage = amperage;
+      lastPower = power;
+      hasLastSample = true;
     }
-  
+
     inline float getCharge() { /* mA*h */
-      return chargeAccumulator / 3600000.0 ;
+      if (!isChargeCached) {
+        charge = chargeIntegral.get(RAW_PER_CHARGE);
+        isChargeCached = true;
+      }
+      return charge;
     }
-  
+
     inline float getEnergy() { /* mW*h */
-      return powerAccumulator / 3600000000.0;
+      if (!isEnergyCached) {
+        energy = energyIntegral.get(RAW_PER_ENERGY);
+        isEnergyCached = true;
+      }
+      return energy;
     }
-  
+
+    inline uint16_t takeChange() {
+      uint16_t result = change;
+      change = 0;
+      return result;
+    }
+
     uint16_t reset(float averageCharge = 0, float averageEnergy = 0) {
-      uint16_t change = 0;
-      uint64_t newChargeAccumulator = averageCharge * 3600000.0;
-      if (chargeAccumulator != newChargeAccumulator) {
-        chargeAccumulator = newChargeAccumulator;
-        change |= AverageCharge;
+      uint16_t result = 0;
+      if (getCharge() != averageCharge) {
+        chargeIntegral.set(averageCharge, RAW_PER_CHARGE);
+        isChargeCached = false;
+        result |= AverageCharge;
       }
-      uint64_t newPowerAccumulator  = averageEnergy * 3600000000.0;
-      if (powerAccumulator != newPowerAccumulator) {
-        powerAccumulator = newPowerAccumulator;
-        change |= AverageEnergy;
+      if (getEnergy() != averageEnergy) {
+        energyIntegral.set(averageEnergy, RAW_PER_ENERGY);
+        isEnergyCached = false;
+        result |= AverageEnergy;
       }
-      return change;
+      return result;
     }
   };
 
   static struct State {
+    uint32_t measurementTime;
     int16_t averageTemperature;
     uint16_t desiredAmperage;
     uint32_t stopVoltage;
-    uint16_t changeFlag;
+    uint32_t desiredPower;
+    uint32_t desiredResistance;
+    uint32_t desiredVoltage;
+    uint16_t transientLowAmperage;
+    uint8_t transientPeriod;
+    uint8_t transientDuty;
+    uint32_t changeFlag; // raised since the last takeChangeFlags()
+    uint32_t visibleChangeFlag; // raised since the running task saw them last
+    LoadMode loadMode;
     bool deviceIsInShutDownMode:1;
     bool deviceStatusIsOn:1;
-    State() : averageTemperature(0), 
+    State() : measurementTime(0),
+              averageTemperature(0), 
               desiredAmperage(0), 
               stopVoltage(0), 
+              desiredPower(0),
+              desiredResistance(0),
+              desiredVoltage(0),
+              transientLowAmperage(0),
+              transientPeriod(10),
+              transientDuty(50),
               changeFlag(-1), 
+              visibleChangeFlag(0),
+              loadMode(ConstantCurrent),
               deviceIsInShutDownMode(false),
               deviceStatusIsOn(false) {}
   } state;
 
-  AverageValueAccumulator<uint16_t, uint32_t> amperage;
-  AverageValueAccumulator<uint32_t, uint32_t> voltage;
+  StreamingStats<uint16_t, uint32_t, Statistics::Mean, Statistics::MinMax, Statistics::Ripple> amperage;
+  StreamingStats<uint32_t, uint32_t, Statistics::Mean, Statistics::MinMax, Statistics::Ripple> voltage;
   ElectricPowerValueAccumulator averageCapacity;
   
-  void setAmperage(uint16_t value) {
-    if (amperage.addMeasurement(value)) {
+  void setMeasurement(uint32_t time, uint16_t amperageValue, uint32_t voltageValue) {
+    state.measurementTime = time;
+    state.changeFlag |= SystemParameterChanged::NewMeasurement;
+    if (amperage.addMeasurement(amperageValue)) {
       state.changeFlag |= SystemParameterChanged::InstantAmperage;
     }
-  }
-  
-  void setVoltage(uint32_t value) {
-    if (voltage.addMeasurement(value)) {
+    if (voltage.addMeasurement(voltageValue)) {
       state.changeFlag |= SystemParameterChanged::InstantVoltage;
     }
+    averageCapacity.addMeasurement(time, amperageValue, voltageValue);
+  }
+
+  uint32_t getMeasurementTime() {
+    return state.measurementTime;
   }
 
   void setDesiredAmperage(uint16_t value) {
@@ -92,6 +196,91 @@ namespace SystemState {
     return state.stopVoltage;
   }
   
+  LoadMode getLoadMode() {
+    return state.loadMode;
+  }
+
+  void setLoadMode(LoadMode value) {
+    if (state.loadMode != value) {
+      state.loadMode = value;
+      state.changeFlag |= SystemParameterChanged::LoadSetpoint;
+    }
+  }
+
+  template<typename T>
+  static void setModeValue(T &field, T value) {
+    if (field != value) {
+      field = value;
+      state.changeFlag |= SystemParameterChanged::LoadSetpoint;
+    }
+  }
+
+  uint32_t getDesiredPower() {
+    return state.desiredPower;
+  }
+
+  void setDesiredPower(uint32_t value) {
+    setModeValue(state.desiredPower, value);
+  }
+
+  uint32_t getDesiredResistance() {
+    return state.desiredResistance;
+  }
+
+  void setDesiredResistance(uint32_t value) {
+    setModeValue(state.desiredResistance, value);
+  }
+
+  uint32_t getDesiredVoltage() {
+    return state.desiredVoltage;
+  }
+
+  void setDesiredVoltage(uint32_t value) {
+    setModeValue(state.desiredVoltage, value);
+  }
+
+  uint16_t getTransientLowAmperage() {
+    return state.transientLowAmperage;
+  }
+
+  void setTransientLowAmperage(uint16_t value) {
+    setModeValue(state.transientLowAmperage, value);
+  }
+
+  uint8_t getTransientPeriod() {
+    return state.transientPeriod;
+  }
+
+  void setTransientPeriod(uint8_t value) {
+    setModeValue(state.transientPeriod, value);
+  }
+
+  uint8_t getTransientDuty() {
+    return state.transientDuty;
+  }
+
+  void setTransientDuty(uint8_t value) {
+    setModeValue(state.transientDuty, value);
+  }
+
+  uint32_t getLoadSetpoint() {
+    switch (state.loadMode) {
+      case ConstantPower: return state.desiredPower;
+      case ConstantResistance: return state.desiredResistance;
+      case ConstantVoltage: return state.desiredVoltage;
+      default: return state.desiredAmperage;
+    }
+  }
+
+  void setLoadSetpoint(uint32_t value) {
+    switch (state.loadMode) {
+      case ConstantPower: setDesiredPower(value); break;
+      case ConstantResistance: setDesiredResistance(value); break;
+      case ConstantVoltage: setDesiredVoltage(value); break;
+      default: setDesiredAmperage(value); break;
+    }
+  }
+
   void setAverageTemperature(int16_t value) {
     if (state.averageTemperature != value) {
       state.averageTemperature = value;
@@ -99,22 +288,14 @@ namespace SystemState {
     }
   }
   
-  void calculateAverage(uint32_t timePassedMillis) {
+  void calculateAverage() {
     if (amperage.calculateAverageValue()) {
       state.changeFlag |= SystemParameterChanged::AverageAmperage;
     }
     if (voltage.calculateAverageValue()) {
       state.changeFlag |= SystemParameterChanged::AverageVoltage;
     }
-    uint16_t averageAmperage = getAverageAmperage();
-    uint32_t averageVoltage = getAverageVoltage();
-    averageCapacity.addMeasurement(getAverageAmperage(), getAverageVoltage(), timePassedMillis);
-    if (timePassedMillis != 0 && averageAmperage != 0) {
-      state.changeFlag |= SystemParameterChanged::AverageCharge;
-      if (getAverageVoltage() != 0) {
-        state.changeFlag |= SystemParameterChanged::AverageEnergy;
-      }
-    }
+    state.changeFlag |= averageCapacity.takeChange();
   }
   
   uint16_t getInstantAmperage() {
@@ -125,6 +306,18 @@ namespace SystemState {
     return amperage.getAverageValue();
   }
 
+  uint16_t getMinAmperage() {
+    return amperage.getMinValue();
+  }
+
+  uint16_t getMaxAmperage() {
+    return amperage.getMaxValue();
+  }
+
+  uint16_t getAmperageRipple() {
+    return amperage.getRippleValue();
+  }
+
   uint32_t getInstantVoltage() {
     return voltage.getInstantValue();
   }
@@ -133,6 +326,18 @@ namespace SystemState {
     return voltage.getAverageValue();
   }
   
+  uint32_t getMinVoltage() {
+    return voltage.getMinValue();
+  }
+
+  uint32_t getMaxVoltage() {
+    return voltage.getMaxValue();
+  }
+
+  uint32_t getVoltageRipple() {
+    return voltage.getRippleValue();
+  }
+
   int16_t getAverageTemperature() {
     return state.averageTemperature;
   }
@@ -157,12 +362,18 @@ namespace SystemState {
     state.changeFlag |= averageCapacity.reset(averageCharge, averageEnergy);
   }
 
-  void clearChangeFlag() {
+  uint32_t takeChangeFlags() {
+    uint32_t changeFlag = state.changeFlag;
     state.changeFlag = SystemParameterChanged::Nothing;
+    return changeFlag;
+  }
+
+  void setVisibleChangeFlags(uint32_t value) {
+    state.visibleChangeFlag = value;
   }
 
   bool isChanged(SystemParameterChanged systemParameter) {
-    return state.changeFlag & systemParameter;
+    return getChangeFlags() & systemParameter;
   }
 
   void setDeviceStatusIsOn(bool value) {
@@ -193,7 +404,11 @@ namespace SystemState {
     state.changeFlag |= changeType;
   }
 
+  uint32_t getChangeFlags() {
+    return state.visibleChangeFlag | state.changeFlag;
+  }
+
   bool isFirstLoop() {
-    return state.changeFlag == -1;
+    return state.visibleChangeFlag == UINT32_MAX;
   }
 };
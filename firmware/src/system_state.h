@@ -3,17 +3,27 @@
 namespace SystemState {
   void setup();
 
-  void calculateAverage(uint32_t timePassedMillis);
-  void clearChangeFlag();
+  // Averages and charge/energy change flags are raised once per call
+  void calculateAverage();
   bool isFirstLoop();
+
+  // Gauge sample, ms, mA, mV. Charge and energy integrate every sample.
+  void setMeasurement(uint32_t time, uint16_t amperage, uint32_t voltage);
+  uint32_t getMeasurementTime();
   
   uint16_t getInstantAmperage();
   uint16_t getAverageAmperage();
-  void setAmperage(uint16_t value);
 
   uint32_t getInstantVoltage();
   uint32_t getAverageVoltage();
-  void setVoltage(uint32_t value);
+
+  // Lowest, highest sample and RMS ripple of the last averaging window
+  uint16_t getMinAmperage();
+  uint16_t getMaxAmperage();
+  uint16_t getAmperageRipple();
+  uint32_t getMinVoltage();
+  uint32_t getMaxVoltage();
+  uint32_t getVoltageRipple();
   
   uint16_t getDesiredAmperage();
   void setDesiredAmperage(uint16_t value);
@@ -21,6 +31,38 @@ namespace SystemState {
   uint32_t getStopVoltage();
   void setStopVoltage(uint32_t value);
 
+  enum LoadMode : uint8_t {
+    ConstantCurrent, // desired amperage
+    ConstantPower, // desired power
+    ConstantResistance, // desired resistance
+    ConstantVoltage, // desired voltage
+    Transient, // desired amperage and transient low amperage in turns
+    LoadModeCount,
+  };
+
+  LoadMode getLoadMode();
+  void setLoadMode(LoadMode value);
+
+  uint32_t getDesiredPower(); // mW
+  void setDesiredPower(uint32_t value);
+
+  uint32_t getDesiredResistance(); // mOhm
+  void setDesiredResistance(uint32_t value);
+
+  uint32_t getDesiredVoltage(); // mV
+  void setDesiredVoltage(uint32_t value);
+
+  uint16_t getTransientLowAmperage(); // mA
+  void setTransientLowAmperage(uint16_t value);
+  uint8_t getTransientPeriod(); // ms
+  void setTransientPeriod(uint8_t value);
+  uint8_t getTransientDuty(); // % of period at desired amperage
+  void setTransientDuty(uint8_t value);
+
+  // Setpoint of the current load mode in its own units
+  uint32_t getLoadSetpoint();
+  void setLoadSetpoint(uint32_t value);
+
   int16_t getAverageTemperature();
   void setAverageTemperature(int16_t value);
   
@@ -34,7 +76,7 @@ namespace SystemState {
   void setDeviceStatusIsOn(bool value);
   void setDeviceIsInShutDownMode(bool value);
 
-  enum SystemParameterChanged {
+  enum SystemParameterChanged : uint32_t {
     Nothing = 0,
     InstantAmperage = 1 << 0,
     AverageAmperage = 1 << 1,
@@ -49,11 +91,21 @@ namespace SystemState {
     DeviceIsInShutDownMode = 1 << 10,
     SdCardLogFile = 1 << 11,
     MainEmergency = 1 << 12,
+    NewMeasurement = 1 << 13,
+    CurrentCalibration = 1 << 14,
+    LoadSetpoint = 1 << 15, // load mode or setpoint other than desired amperage
+    ControlCommand = 1UL << 16, // remote command which may change pwm, even if nothing changed
     AveragePower = AverageVoltage | AverageAmperage, // mW
   };
 
+  // Flags are delivered to every task by TaskScheduler. Task sees flags
+  // raised since its previous run plus flags it raises itself. Tasks which
+  // subscribe to flags run only after one of them was raised.
   void setChangeFlag(SystemParameterChanged changeType);
   bool isChanged(SystemParameterChanged systemParameter);
+  uint32_t getChangeFlags();
+  uint32_t takeChangeFlags();
+  void setVisibleChangeFlags(uint32_t value);
 
   inline void debugPrint() {
     if (isChanged(InstantAmperage)) {
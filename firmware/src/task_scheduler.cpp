@@ -0,0 +1,128 @@
+#include <Arduino.h>
+
+#include "task_scheduler.h"
+#include "system_state.h"
+
+namespace TaskScheduler {
+  static const Task *tasks = NULL;
+  static TaskStats *stats = NULL;
+  static uint8_t taskCount = 0;
+
+  void setup(const Task *taskTable, TaskStats *taskStats, uint8_t count) {
+    tasks = taskTable;
+    stats = taskStats;
+    taskCount = count;
+    uint32_t now = micros();
+    for (uint8_t i = 0; i < taskCount; ++i) {
+      stats[i] = TaskStats();
+      stats[i].release = now;
+    }
+  }
+
+  static void deliverChangeFlags(uint8_t except) {
+    uint32_t changeFlags = SystemState::takeChangeFlags();
+    if (!changeFlags) {
+      return;
+    }
+    for (uint8_t i = 0; i < taskCount; ++i) {
+      if (i != except) {
+        stats[i].changeFlags |= changeFlags;
+      }
+    }
+  }
+
+  static bool isDue(uint8_t index, uint32_t now) {
+    return (int32_t) (now - stats[index].release) >= 0;
+  }
+
+  // Due task waiting for its flags is released again, so its lateness counts
+  // from about when the flag arrived
+  static bool isReleased(uint8_t index, const Task &task) {
+    uint32_t now = micros();
+    if (!isDue(index, now)) {
+      return false;
+    }
+    if (task.subscriptions == 0) {
+      return true;
+    }
+    deliverChangeFlags(taskCount);
+    if (stats[index].changeFlags & task.subscriptions) {
+      return true;
+    }
+    stats[index].release = now;
+    return false;
+  }
+
+  static void execute(uint8_t index, const Task &task) {
+    TaskStats &taskStats = stats[index];
+    deliverChangeFlags(taskCount);
+    SystemState::setVisibleChangeFlags(taskStats.changeFlags);
+    taskStats.changeFlags = 0;
+
+    uint32_t startTime = micros();
+    task.run();
+    uint32_t endTime = micros();
+
+    deliverChangeFlags(index);
+    SystemState::setVisibleChangeFlags(0);
+
+    ++taskStats.runs;
+    uint32_t executionTime = endTime - startTime;
+    if (executionTime > taskStats.worstExecutionTime) {
+      taskStats.worstExecutionTime = min(executionTime, (uint32_t) UINT16_MAX);
+    }
+    if (endTime - taskStats.release > task.deadlineMs * 1000UL && taskStats.overruns != UINT16_MAX) {
+      ++taskStats.overruns;
+    }
+
+    if (task.periodMs == 0) {
+      // Period-less tasks are released again as soon as they finish
+      taskStats.release = endTime;
+      return;
+    }
+    taskStats.release += task.periodMs * 1000UL;
+    if (isDue(index, endTime)) {
+      // Missed periods are skipped rather than run back to back
+      taskStats.release = endTime;
+    }
+  }
+
+  static void runTasks(bool isCritical) {
+    Task task;
+    for (uint8_t i = 0; i < taskCount; ++i) {
+      memcpy_P(&task, &tasks[i], sizeof(Task));
+      if (task.isCritical != isCritical || !isReleased(i, task)) {
+        continue;
+      }
+      execute(i, task);
+      if (!isCritical) {
+        runTasks(true);
+      }
+    }
+  }
+
+  void run() {
+    runTasks(true);
+    runTasks(false);
+  }
+
+  uint8_t getTaskCount() {
+    return taskCount;
+  }
+
+  void getTask(uint8_t index, Task &task) {
+    memcpy_P(&task, &tasks[index], sizeof(Task));
+  }
+
+  const TaskStats &getStats(uint8_t index) {
+    return stats[index];
+  }
+
+  void resetStats() {
+    for (uint8_t i = 0; i < taskCount; ++i) {
+      stats[i].worstExecutionTime = 0;
+      stats[i].overruns = 0;
+      stats[i].runs = 0;
+    }
+  }
+};
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdint.h>
+
+// Cooperative scheduler over a static PROGMEM task table. Table order is
+// priority order. Critical tasks are run again after every other task, so
+// slow tasks delay them by at most one task execution.
+//
+// Change flags of SystemState are delivered per task: task sees flags raised
+// by other tasks since its own previous run and flags it raises itself. Task
+// with subscriptions is run only once one of its flags arrives, so handlers
+// are not called just to find out nothing they watch has changed.
+namespace TaskScheduler {
+  struct Task {
+    char name[8];
+    void (*run)();
+    uint16_t periodMs; // 0 runs task on every pass
+    uint16_t deadlineMs; // allowed lateness of task end after its release
+    bool isCritical;
+    uint32_t subscriptions; // SystemState::SystemParameterChanged bits, 0 runs on period only
+  };
+
+  struct TaskStats {
+    uint32_t release; // us, when task is due next
+    uint16_t worstExecutionTime; // us, saturated
+    uint16_t overruns;
+    uint16_t runs; // wraps
+    uint32_t changeFlags; // raised since task run last
+  };
+
+  void setup(const Task *tasks, TaskStats *stats, uint8_t count);
+  // Runs tasks which are due, returns after one pass over the table
+  void run();
+
+  uint8_t getTaskCount();
+  void getTask(uint8_t index, Task &task);
+  const TaskStats &getStats(uint8_t index);
+  void resetStats();
+
+  template<uint8_t N>
+  inline void setup(const Task (&tasks)[N], TaskStats (&stats)[N]) {
+    setup(tasks, stats, N);
+  }
+};
@@ -0,0 +1,112 @@
+#include <Arduino.h>
+#include <util/atomic.h>
+
+#include "telemetry.h"
+
+#if TELEMETRY_ENABLED
+
+#include "telemetry_protocol.h"
+#include "ring_buffer.h"
+#include "system_state.h"
+#include "managers.h"
+
+namespace Telemetry {
+  static RingBuffer<uint8_t, TELEMETRY_BUFFER_SIZE> transmitBuffer;
+  static uint8_t sequence = 0;
+  static uint16_t droppedPackets = 0;
+  static uint32_t lastStateTime = 0;
+
+  void setup() {
+    // Double speed mode, 500k and 1M baud are exact with 16MHz clock
+    UCSR0A = _BV(U2X0);
+    UBRR0 = F_CPU / 8 / TELEMETRY_BAUD_RATE - 1;
+    UCSR0C = _BV(UCSZ01) | _BV(UCSZ00); // 8N1
+    UCSR0B = _BV(TXEN0);
+  }
+
+  static void sendPacket(TelemetryProtocol::PacketType type, const void *payload, uint8_t payloadSize) {
+    uint8_t packet[TelemetryProtocol::MAX_PACKET_SIZE];
+    TelemetryProtocol::Header header = {type, sequence++};
+    memcpy(packet, &header, sizeof(header));
+    memcpy(packet + sizeof(header), payload, payloadSize);
+    uint8_t length = sizeof(header) + payloadSize;
+    uint16_t crc = 0xFFFF;
+    for (uint8_t i = 0; i < length; ++i) {
+      crc = TelemetryProtocol::crcUpdate(crc, packet[i]);
+    }
+    packet[length++] = crc & 0xFF;
+    packet[length++] = crc >> 8;
+
+    uint8_t frame[TelemetryProtocol::MAX_FRAME_SIZE];
+    uint8_t frameLength = TelemetryProtocol::encodeFrame(packet, length, frame);
+    if (transmitBuffer.getFreeSpace() < frameLength) {
+      ++droppedPackets;
+      return;
+    }
+    for (uint8_t i = 0; i < frameLength; ++i) {
+      transmitBuffer.push(frame[i]);
+    }
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      UCSR0B |= _BV(UDRIE0);
+    }
+  }
+
+  void sendSample(uint32_t timestamp, uint16_t amperage, uint16_t voltage) {
+    TelemetryProtocol::SamplePayload payload = {timestamp, amperage, voltage};
+    sendPacket(TelemetryProtocol::Sample, &payload, sizeof(payload));
+  }
+
+  void sendSystemState() {
+    uint32_t changeFlags = SystemState::getChangeFlags();
+    static const uint32_t STATE_CHANGES = SystemState::DesiredAmperage
+        | SystemState::StopVoltage
+        | SystemState::DeviceStatusIsOn
+        | SystemState::DeviceIsInShutDownMode
+        | SystemState::MainEmergency
+        | SystemState::CurrentCalibration
+        | SystemState::LoadSetpoint;
+    uint32_t now = millis();
+    if (now - lastStateTime < REFRESH_INTERVAL_MS && !(changeFlags & STATE_CHANGES)) {
+      return;
+    }
+    lastStateTime = now;
+    TelemetryProtocol::StatePayload payload = {
+      {
+        now,
+        SystemState::getInstantAmperage(),
+        SystemState::getAverageAmperage(),
+        (uint16_t) SystemState::getInstantVoltage(),
+        (uint16_t) SystemState::getAverageVoltage(),
+        SystemState::getAverageTemperature(),
+        SystemState::getAverageCharge(),
+        SystemState::getAverageEnergy(),
+        EmergencyManager::getEmergency(),
+        AmperagePinManager::getInternalResistance(),
+      },
+      SystemState::getDesiredAmperage(),
+      SystemState::getStopVoltage(),
+      SystemState::getLoadMode(),
+      SystemState::getLoadSetpoint(),
+      AmperagePinManager::getTargetAmperage(),
+      (uint16_t) changeFlags,
+      droppedPackets,
+    };
+    sendPacket(TelemetryProtocol::State, &payload, sizeof(payload));
+  }
+
+  uint16_t getDroppedPackets() {
+    return droppedPackets;
+  }
+};
+
+ISR(USART_UDRE_vect) {
+  using namespace Telemetry;
+  uint8_t data;
+  if (transmitBuffer.pop(data)) {
+    UDR0 = data;
+  } else {
+    UCSR0B &= ~_BV(UDRIE0);
+  }
+}
+
+#endif
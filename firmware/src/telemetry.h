@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "constants.h"
+
+// Binary telemetry stream, see telemetry_protocol.h. Owns USART0 instead of
+// Serial, bytes are sent from data register empty interrupt so sending
+// never waits. Packets that do not fit transmit buffer are dropped.
+namespace Telemetry {
+#if TELEMETRY_ENABLED
+  void setup();
+  void sendSample(uint32_t timestamp, uint16_t amperage, uint16_t voltage);
+  // Sends state every REFRESH_INTERVAL_MS or when setpoints, status or
+  // emergency change
+  void sendSystemState();
+  uint16_t getDroppedPackets();
+#else
+  inline void setup() {}
+  inline void sendSample(uint32_t, uint16_t, uint16_t) {}
+  inline void sendSystemState() {}
+  inline uint16_t getDroppedPackets() { return 0; }
+#endif
+};
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "binary_log.h"
+
+// Binary UART telemetry. Shared with host side receiver in tools/, so it
+// should not depend on Arduino headers. All values are little endian.
+//
+// Every packet is [type, sequence, payload..., crc low, crc high], COBS
+// encoded and terminated by zero byte. Sequence increments for every packet
+// including dropped ones, so receiver counts gaps as lost packets.
+namespace TelemetryProtocol {
+  enum PacketType : uint8_t {
+    Sample = 1, // SamplePayload, every gauge sample
+    State = 2, // StatePayload, once per refresh interval and on changes
+  };
+
+  struct __attribute__((packed)) Header {
+    uint8_t type;
+    uint8_t sequence;
+  };
+
+  typedef BinaryLog::RawRecord SamplePayload;
+
+  struct __attribute__((packed)) StatePayload {
+    BinaryLog::Record record;
+    uint16_t desiredAmperage; // mA
+    uint32_t stopVoltage; // mV
+    uint8_t loadMode; // SystemState::LoadMode
+    uint32_t loadSetpoint; // mA, mW, mOhm or mV depending on load mode
+    uint16_t targetAmperage; // mA, current regulated right now
+    uint16_t changeFlags; // low 16 SystemState::SystemParameterChanged bits
+    uint16_t droppedPackets; // not sent because transmit buffer was full
+  };
+
+  static const uint8_t MAX_PACKET_SIZE = sizeof(Header) + sizeof(StatePayload) + sizeof(uint16_t);
+  // COBS adds one byte per 254 bytes, plus zero delimiter
+  static const uint8_t MAX_FRAME_SIZE = MAX_PACKET_SIZE + 2;
+  static_assert(MAX_PACKET_SIZE < 254, "Packet should fit single COBS block");
+
+  // CRC-16/CCITT, same as _crc_ccitt_update from avr-libc
+  inline uint16_t crcUpdate(uint16_t crc, uint8_t data) {
+    data ^= crc & 0xFF;
+    data ^= data << 4;
+    return (((uint16_t) data << 8) | (crc >> 8)) ^ (uint8_t) (data >> 4) ^ ((uint16_t) data << 3);
+  }
+
+  // Encodes packet of at most MAX_PACKET_SIZE bytes into frame of
+  // MAX_FRAME_SIZE bytes, returns frame length including delimiter.
+  inline uint8_t encodeFrame(const uint8_t *packet, uint8_t length, uint8_t *frame) {
+    uint8_t codeIndex = 0;
+    uint8_t frameLength = 1;
+    for (uint8_t i = 0; i < length; ++i) {
+      if (packet[i] == 0) {
+        frame[codeIndex] = frameLength - codeIndex;
+        codeIndex = frameLength++;
+      } else {
+        frame[frameLength++] = packet[i];
+      }
+    }
+    frame[codeIndex] = frameLength - codeIndex;
+    frame[frameLength++] = 0;
+    return frameLength;
+  }
+};
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "constants.h"
+
+// Thermistor ADC reading to temperature conversion. Beta equation is
+// evaluated by compiler, firmware only interpolates between table points.
+namespace ThermistorTable {
+  // ADC values are passed in 1/16 of LSB so averaged readings keep precision
+  static const uint8_t ADC_FRACTION_BITS = 4;
+  static const uint8_t STEP_BITS = 4 + ADC_FRACTION_BITS; // point every 16 ADC LSB
+  static const uint8_t POINTS = (1024 >> (STEP_BITS - ADC_FRACTION_BITS)) + 1;
+
+  static const int16_t MIN_TEMPERATURE = -999; // 0.1 *C
+  static const int16_t MAX_TEMPERATURE = 2000;
+
+  constexpr float clampTemperature(float deciDegree) {
+    return deciDegree < MIN_TEMPERATURE ? MIN_TEMPERATURE
+        : deciDegree > MAX_TEMPERATURE ? MAX_TEMPERATURE
+        : deciDegree;
+  }
+
+  constexpr int16_t roundTemperature(float deciDegree) {
+    return deciDegree < 0 ? deciDegree - 0.5f : deciDegree + 0.5f;
+  }
+
+  constexpr float resistanceToTemperature(float resistance) {
+    return 10 * (1.0f / (__builtin_logf(resistance / THERMISTOR_NOMINAL) / B_COEFFICIENT
+        + 1.0f / (TEMPERATURE_NOMINAL + 273.15f)) - 273.15f);
+  }
+
+  // Same math FanTemperatureReader used to do in runtime. Zero reading is
+  // treated as the hottest to keep interpolation of the first segment sane.
+  constexpr int16_t adcToTemperature(float adc) {
+    return adc <= 0 ? MAX_TEMPERATURE
+        : adc >= 1023 ? MIN_TEMPERATURE
+        : roundTemperature(clampTemperature(resistanceToTemperature(
+            THERMISTOR_SERIES_RESISTOR / (1023 / adc - 1))));
+  }
+
+  template<uint8_t... Is> struct IndexSequence {};
+  template<uint8_t N, uint8_t... Is> struct MakeIndexSequence : MakeIndexSequence<N - 1, N - 1, Is...> {};
+  template<uint8_t... Is> struct MakeIndexSequence<0, Is...> {
+    typedef IndexSequence<Is...> type;
+  };
+
+  template<typename Sequence> struct Table;
+  template<uint8_t... Is> struct Table<IndexSequence<Is...>> {
+    static const int16_t values[sizeof...(Is)];
+  };
+  template<uint8_t... Is> const int16_t Table<IndexSequence<Is...>>::values[sizeof...(Is)] PROGMEM = {
+    adcToTemperature(Is << (STEP_BITS - ADC_FRACTION_BITS))...
+  };
+
+  typedef Table<MakeIndexSequence<POINTS>::type> Points;
+
+  // adcValue is in 1/16 of ADC LSB, result is in 0.1 *C
+  inline int16_t toTemperature(uint16_t adcValue) {
+    uint8_t index = adcValue >> STEP_BITS;
+    if (index >= POINTS - 1) {
+      return pgm_read_word_near(Points::values + POINTS - 1);
+    }
+    int16_t low = pgm_read_word_near(Points::values + index);
+    int16_t high = pgm_read_word_near(Points::values + index + 1);
+    uint8_t fraction = adcValue & ((1 << STEP_BITS) - 1);
+    return low + (((int32_t) (high - low) * fraction) >> STEP_BITS);
+  }
+};
@@ -0,0 +1,129 @@
+// Compares the GaugeReader curves (firmware/src/gauge_calibration.h) with the
+// float math they replaced, over the whole shunt register range and over bus
+// voltages at several load currents, and measures host cycles per sample for
+// both. Above 6091 mA the float reference uses the intended 0.989 * a + 101,
+// the old code parsed it as a comma expression and applied nothing. Fails if
+// current is off by more than 3 mA or voltage by more than 2 mV.
+//
+// Build: g++ -O2 -std=c++11 -o calibration_check tools/calibration_check.cpp
+// Usage: calibration_check
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../firmware/src/gauge_calibration.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace {
+  const int16_t MAX_SHUNT_VOLTAGE = 32000; // 10uV, 320mV range
+  const int16_t MAX_BUS_VOLTAGE = 32000; // mV
+  const int32_t AMPERAGE_TOLERANCE = 3; // mA
+  const int32_t VOLTAGE_TOLERANCE = 2; // mV
+  const uint32_t BENCH_ROUNDS = 200;
+
+  uint64_t readCycles() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+#endif
+  }
+
+  float referenceAmperage(int16_t shuntVoltage) {
+    float amperage = shuntVoltage * 0.01 * 60;
+    if (amperage < NOICE_AMPERAGE) {
+      amperage = 0;
+    } else if (amperage < 3778) {
+      amperage += amperage * 0.009;
+    } else if (amperage < 6091) {
+      amperage += 34;
+    } else {
+      amperage += -0.011 * amperage + 101;
+    }
+    return amperage;
+  }
+
+  int32_t referenceVoltage(int16_t busVoltage, float amperage) {
+    int32_t voltage = busVoltage;
+    if (voltage < NOISE_VOLTAGE) {
+      return 0;
+    }
+    voltage += (-27 * voltage + 430000) / 10000;
+    voltage += amperage * 24 / 1000;
+    return voltage;
+  }
+
+  struct Error {
+    int32_t max;
+    int32_t at;
+    uint32_t failures;
+
+    void add(int32_t error, int32_t position, int32_t tolerance) {
+      error = abs(error);
+      if (error > max) {
+        max = error;
+        at = position;
+      }
+      failures += error > tolerance;
+    }
+  };
+
+  // Summing the results keeps the loops from being optimized out
+  template<typename Convert>
+  double measure(Convert convert, int32_t &sum) {
+    uint64_t start = readCycles();
+    for (uint32_t round = 0; round < BENCH_ROUNDS; ++round) {
+      for (int16_t shuntVoltage = 0; shuntVoltage < MAX_SHUNT_VOLTAGE; shuntVoltage += 3) {
+        sum += convert(shuntVoltage, (int16_t) (shuntVoltage + 8000));
+      }
+    }
+    return (double) (readCycles() - start) / (BENCH_ROUNDS * (MAX_SHUNT_VOLTAGE / 3 + 1));
+  }
+};
+
+int main() {
+  // Firmware stores both as integers, float values were truncated
+  Error amperageError = {0, 0, 0};
+  for (int16_t shuntVoltage = 0; shuntVoltage <= MAX_SHUNT_VOLTAGE; ++shuntVoltage) {
+    int32_t expected = referenceAmperage(shuntVoltage);
+    amperageError.add(GaugeCalibration::toAmperage(shuntVoltage) - expected, shuntVoltage, AMPERAGE_TOLERANCE);
+  }
+  printf("amperage: largest error %d mA at shunt register %d (%d mA)\n",
+      amperageError.max, amperageError.at, (int32_t) referenceAmperage(amperageError.at));
+
+  static const int16_t SHUNT_VOLTAGES[] = {0, 1000, 5000, 12000, MAX_SHUNT_VOLTAGE};
+  Error voltageError = {0, 0, 0};
+  for (int16_t shuntVoltage : SHUNT_VOLTAGES) {
+    float amperage = referenceAmperage(shuntVoltage);
+    for (int16_t busVoltage = 0; busVoltage <= MAX_BUS_VOLTAGE; busVoltage += 4) {
+      int32_t actual = GaugeCalibration::toVoltage(busVoltage, GaugeCalibration::toAmperage(shuntVoltage));
+      voltageError.add(actual - referenceVoltage(busVoltage, amperage), busVoltage, VOLTAGE_TOLERANCE);
+    }
+  }
+  printf("voltage: largest error %d mV at bus %d mV\n", voltageError.max, voltageError.at);
+
+  int32_t sum = 0;
+  double fixedCycles = measure([](int16_t shuntVoltage, int16_t busVoltage) {
+    int32_t amperage = GaugeCalibration::toAmperage(shuntVoltage);
+    return amperage + GaugeCalibration::toVoltage(busVoltage, amperage);
+  }, sum);
+  double floatCycles = measure([](int16_t shuntVoltage, int16_t busVoltage) {
+    float amperage = referenceAmperage(shuntVoltage);
+    return (int32_t) amperage + referenceVoltage(busVoltage, amperage);
+  }, sum);
+  printf("fixed point %.2f cycles, float %.2f cycles per sample (%d)\n", fixedCycles, floatCycles, sum);
+
+  if (amperageError.failures != 0 || voltageError.failures != 0) {
+    printf("%u currents off by more than %d mA, %u voltages off by more than %d mV\n",
+        amperageError.failures, AMPERAGE_TOLERANCE, voltageError.failures, VOLTAGE_TOLERANCE);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,163 @@
+// Drives remote control commands (firmware/src/remote_control.h) through a
+// serial port or pty and reports throughput in commands per second. Every
+// current setting is read back, so a wrong answer is reported as failure.
+//
+// Build: g++ -O2 -std=c++11 -o command_bench tools/command_bench.cpp
+// Usage: command_bench [--baud 115200] [--count 1000] /dev/ttyUSB0
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <string>
+
+namespace {
+  const int REPLY_TIMEOUT_MS = 2000;
+
+  speed_t toSpeed(long baud) {
+    switch (baud) {
+      case 9600: return B9600;
+      case 57600: return B57600;
+      case 115200: return B115200;
+      case 230400: return B230400;
+#ifdef B500000
+      case 500000: return B500000;
+      case 1000000: return B1000000;
+#endif
+      default: return 0;
+    }
+  }
+
+  bool configurePort(int fd, long baud) {
+    if (!isatty(fd)) {
+      return true;
+    }
+    speed_t speed = toSpeed(baud);
+    struct termios options;
+    if (speed == 0 || tcgetattr(fd, &options) != 0) {
+      return false;
+    }
+    cfmakeraw(&options);
+    cfsetispeed(&options, speed);
+    cfsetospeed(&options, speed);
+    return tcsetattr(fd, TCSANOW, &options) == 0;
+  }
+
+  double now() {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec * 1e-9;
+  }
+
+  class Port {
+    int fd;
+    std::string pending;
+  public:
+    explicit Port(int fd) : fd(fd) {}
+
+    bool send(const std::string &command) {
+      std::string data = command + "\n";
+      return write(fd, data.data(), data.size()) == (ssize_t) data.size();
+    }
+
+    bool readLine(std::string &line) {
+      for (;;) {
+        size_t end = pending.find('\n');
+        if (end != std::string::npos) {
+          line = pending.substr(0, end);
+          if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+          }
+          pending.erase(0, end + 1);
+          return true;
+        }
+        struct pollfd request = {fd, POLLIN, 0};
+        if (poll(&request, 1, REPLY_TIMEOUT_MS) <= 0) {
+          return false;
+        }
+        char buffer[256];
+        ssize_t length = read(fd, buffer, sizeof(buffer));
+        if (length <= 0) {
+          return false;
+        }
+        pending.append(buffer, length);
+      }
+    }
+
+    bool query(const std::string &command, std::string &reply) {
+      return send(command) && readLine(reply);
+    }
+  };
+
+  int usage(const char *name) {
+    fprintf(stderr, "Usage: %s [--baud RATE] [--count N] DEVICE\n", name);
+    return 2;
+  }
+}
+
+int main(int argc, char **argv) {
+  long baud = 115200;
+  long count = 1000;
+  const char *path = nullptr;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--baud") == 0 && i + 1 < argc) {
+      baud = atol(argv[++i]);
+    } else if (strcmp(argv[i], "--count") == 0 && i + 1 < argc) {
+      count = atol(argv[++i]);
+    } else if (!path) {
+      path = argv[i];
+    } else {
+      return usage(argv[0]);
+    }
+  }
+  if (!path || count <= 0) {
+    return usage(argv[0]);
+  }
+
+  int fd = open(path, O_RDWR | O_NOCTTY);
+  if (fd < 0) {
+    fprintf(stderr, "Can not open %s: %s\n", path, strerror(errno));
+    return 1;
+  }
+  if (!configurePort(fd, baud)) {
+    fprintf(stderr, "Can not configure %s for %ld baud\n", path, baud);
+    return 1;
+  }
+
+  Port port(fd);
+  std::string reply;
+  if (!port.query("*IDN?", reply)) {
+    fprintf(stderr, "No answer to *IDN?\n");
+    return 1;
+  }
+  printf("device %s\n", reply.c_str());
+
+  long failures = 0;
+  double startTime = now();
+  for (long i = 0; i < count; ++i) {
+    std::string amperage = std::to_string(100 + i % 1000);
+    if (!port.send("CURR " + amperage) || !port.query("CURR?", reply)) {
+      fprintf(stderr, "No answer after %ld commands\n", i * 2);
+      return 1;
+    }
+    if (reply != amperage) {
+      ++failures;
+    }
+  }
+  double elapsed = now() - startTime;
+  printf("commands %ld in %.3f s, %.0f commands/s, %ld wrong answers\n",
+      count * 2, elapsed, count * 2 / elapsed, failures);
+
+  port.send("CURR 0");
+  if (port.query("SYST:LAT?", reply)) {
+    printf("command to pwm latency us (last max) %s\n", reply.c_str());
+  }
+  close(fd);
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,190 @@
+// Runs the I2C driver (firmware/src/i2c_bus.cpp) against the TWI register
+// model of the simulator: the interrupt state machine, the 4-entry queue,
+// the combined STOP+START that chains queued reads, a missing slave, a read
+// started from a callback and lock() while reads are in flight or queued.
+//
+// Build: g++ -O2 -std=gnu++11 -fpermissive -Ifirmware/sim/include -o i2c_bus_check
+//            tools/i2c_bus_check.cpp firmware/src/i2c_bus.cpp firmware/sim/simulator.cpp
+// Usage: i2c_bus_check
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <Arduino.h> // simulator stub
+#include "../firmware/sim/simulator.h"
+#include "../firmware/src/constants.h"
+#include "../firmware/src/i2c_bus.h"
+
+namespace {
+  const uint8_t REG_SHUNT_VOLTAGE = 0x01;
+  const uint8_t REG_BUS_VOLTAGE = 0x02;
+  const uint8_t MISSING_I2C_ADDRESS = 0x41;
+  const uint16_t SOURCE_VOLTAGE = 12000; // mV, no current
+  // Model puts 43 mV behind the shunt, 4 mV LSB, conversion ready bit
+  const uint16_t BUS_REGISTER = (SOURCE_VOLTAGE - 43) / 4 << 3 | 0x02;
+  const uint16_t SHUNT_REGISTER = 0;
+  const uint8_t QUEUE_SIZE = 4;
+  const uint64_t STOP_US = 3; // one bit at 400kHz, rounded up
+
+  struct Read {
+    char name;
+    bool success;
+    uint16_t value;
+    uint64_t time; // us
+  };
+
+  Read reads[16];
+  uint8_t readCount = 0;
+
+  void record(char name, bool success, uint16_t value) {
+    if (readCount < sizeof(reads) / sizeof(reads[0])) {
+      reads[readCount++] = {name, success, value, Sim::now()};
+    }
+  }
+
+  void onShunt(bool success, uint16_t value) { record('s', success, value); }
+  void onBus(bool success, uint16_t value) { record('b', success, value); }
+  void onMissing(bool success, uint16_t value) { record('m', success, value); }
+
+  // As the gauge does: bus voltage read goes right after the shunt one
+  void onShuntThenBus(bool success, uint16_t value) {
+    record('S', success, value);
+    I2cBus::startReadRegister(INA219_I2C_ADDRESS, REG_BUS_VOLTAGE, onBus);
+  }
+
+  bool startShunt() {
+    return I2cBus::startReadRegister(INA219_I2C_ADDRESS, REG_SHUNT_VOLTAGE, onShunt);
+  }
+
+  bool startBus() {
+    return I2cBus::startReadRegister(INA219_I2C_ADDRESS, REG_BUS_VOLTAGE, onBus);
+  }
+
+  void runUntilIdle() {
+    while (I2cBus::isBusy()) {
+      Sim::advance(Sim::getNextEventTime() - Sim::now());
+    }
+  }
+
+  // Names of recorded reads in order, failed ones in upper case
+  bool checkReads(const char *expected) {
+    bool isPassed = strlen(expected) == readCount;
+    for (uint8_t i = 0; i < readCount; ++i) {
+      char name = reads[i].success ? reads[i].name : reads[i].name - 'a' + 'A';
+      uint16_t value = reads[i].name == 'b' ? BUS_REGISTER : SHUNT_REGISTER;
+      isPassed &= i < strlen(expected) && name == expected[i];
+      isPassed &= !reads[i].success || reads[i].value == value;
+    }
+    if (!isPassed) {
+      printf("  expected %s, got", expected);
+      for (uint8_t i = 0; i < readCount; ++i) {
+        printf(" %c%s0x%04x", reads[i].name, reads[i].success ? "=" : "!", reads[i].value);
+      }
+      printf("\n");
+    }
+    return isPassed;
+  }
+
+  bool report(const char *name, bool isPassed) {
+    printf("%-40s %s\n", name, isPassed ? "ok" : "FAIL");
+    readCount = 0;
+    return isPassed;
+  }
+
+  uint64_t readTime = 0; // us, one register read from START to callback
+
+  bool checkSingleRead() {
+    uint64_t start = Sim::now();
+    bool isPassed = startShunt() && I2cBus::isBusy();
+    runUntilIdle();
+    readTime = Sim::now() - start;
+    isPassed &= checkReads("s");
+    printf("  read takes %llu us\n", (unsigned long long) readTime);
+    return report("single read", isPassed);
+  }
+
+  bool checkWrite() {
+    bool isPassed = I2cBus::writeRegister(INA219_I2C_ADDRESS, 0x00, 0x399F);
+    isPassed &= !I2cBus::writeRegister(MISSING_I2C_ADDRESS, 0x00, 0x399F);
+    isPassed &= !I2cBus::isBusy() && startBus();
+    runUntilIdle();
+    isPassed &= checkReads("b");
+    return report("blocking write, missing slave nacks", isPassed);
+  }
+
+  // One read in flight, QUEUE_SIZE queued, the next one is refused. Queued
+  // reads follow each other with STOP+START, no idle bus in between.
+  bool checkQueueFull() {
+    bool isPassed = startShunt();
+    for (uint8_t i = 0; i < QUEUE_SIZE; ++i) {
+      isPassed &= i % 2 ? startShunt() : startBus();
+    }
+    isPassed &= !startBus();
+    runUntilIdle();
+    isPassed &= checkReads("sbsbs");
+    for (uint8_t i = 1; i < readCount; ++i) {
+      uint64_t gap = reads[i].time - reads[i - 1].time;
+      if (gap > readTime + STOP_US) {
+        printf("  read %u came %llu us after the previous one\n", i, (unsigned long long) gap);
+        isPassed = false;
+      }
+    }
+    return report("queue full, queued reads chained", isPassed);
+  }
+
+  bool checkMissingSlave() {
+    bool isPassed = I2cBus::startReadRegister(MISSING_I2C_ADDRESS, REG_BUS_VOLTAGE, onMissing);
+    isPassed &= startBus();
+    runUntilIdle();
+    isPassed &= checkReads("Mb");
+    return report("missing slave fails, queue goes on", isPassed);
+  }
+
+  bool checkReadFromCallback() {
+    bool isPassed = I2cBus::startReadRegister(INA219_I2C_ADDRESS, REG_SHUNT_VOLTAGE, onShuntThenBus);
+    isPassed &= startShunt();
+    runUntilIdle();
+    // Shunt read comes back as 'S' through onShuntThenBus
+    isPassed &= readCount == 3 && reads[0].name == 'S';
+    reads[0].name = 's';
+    isPassed &= checkReads("sbs");
+    return report("read from callback goes ahead of queue", isPassed);
+  }
+
+  // lock() waits for the read in flight and the queued ones, reads asked
+  // for while locked wait for unlock()
+  bool checkLockWhileBusy() {
+    bool isPassed = startShunt() && startBus() && startShunt();
+    I2cBus::lock();
+    isPassed &= !I2cBus::isBusy() && checkReads("sbs");
+    readCount = 0;
+    isPassed &= startBus() && !I2cBus::isBusy();
+    Sim::advance(10 * readTime);
+    isPassed &= readCount == 0;
+    I2cBus::unlock();
+    isPassed &= I2cBus::isBusy();
+    runUntilIdle();
+    isPassed &= checkReads("b");
+    return report("lock while busy, reads wait for unlock", isPassed);
+  }
+};
+
+int main() {
+  Sim::ModelConfig config = {};
+  config.source.voltage = SOURCE_VOLTAGE;
+  config.source.resistance = 50;
+  config.ambientTemperature = 25;
+  config.amperageGain = 1;
+  Sim::setup(config); // seed 0, no noise
+  Sim::setSerialOutput(NULL);
+  I2cBus::setup();
+
+  bool isPassed = checkSingleRead();
+  isPassed &= checkWrite();
+  isPassed &= checkQueueFull();
+  isPassed &= checkMissingSlave();
+  isPassed &= checkReadFromCallback();
+  isPassed &= checkLockWhileBusy();
+  return isPassed ? 0 : 1;
+}
@@ -0,0 +1,121 @@
+// Feeds waveforms with known integrals through SystemState::setMeasurement
+// (firmware/src/system_state.cpp) and compares the accumulated charge and
+// energy with the exact integral of the waveform and with a double trapezoid
+// over the same integer samples. The second comparison isolates the firmware
+// arithmetic and fails past 1e-6. The first one adds sampling and mA/mV
+// rounding and is only reported.
+//
+// Build: g++ -O2 -std=c++11 -Ifirmware/sim/include -o integral_check
+//            tools/integral_check.cpp firmware/src/system_state.cpp
+// Usage: integral_check
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <Arduino.h> // simulator stub
+#include "../firmware/src/system_state.h"
+
+namespace {
+  const double TOLERANCE = 1e-6;
+  const double EXACT_STEP = 0.1; // ms, numeric integration of the waveform
+  const double MS_PER_HOUR = 3.6e6;
+
+  struct Waveform {
+    const char *name;
+    double duration; // ms
+    double (*amperage)(double time); // mA
+    double sourceVoltage; // mV
+    double sourceResistance; // Ohm, voltage drops by amperage * resistance
+    uint32_t (*nextTime)(uint32_t time, uint32_t index); // ms, sample timestamps
+  };
+
+  double constant(double) { return 2000; }
+  double ramp(double time) { return time / 6; }
+  double sine(double time) { return 2000 + 1500 * sin(time / 1000 * 2 * M_PI * 0.37); }
+  double transient(double time) { return fmod(time, 100) < 20 ? 2000 : 200; }
+  double small(double) { return 20; }
+
+  uint32_t regular(uint32_t time, uint32_t) { return time + 5; }
+  // Late and early samples, as when the I2C bus is busy
+  uint32_t jittered(uint32_t time, uint32_t index) { return time + 4 + index * 7919 % 3; }
+  // One second without samples every 10 s, longer than one integration step
+  uint32_t gaps(uint32_t time, uint32_t index) { return time + (index % 2000 == 1999 ? 1000 : 5); }
+
+  const Waveform WAVEFORMS[] = {
+    {"2 A constant, 1 h", 3600e3, constant, 12000, 0.05, regular},
+    {"ramp to 10 A, 60 s", 60e3, ramp, 12000, 0.05, regular},
+    {"2 A +-1.5 A sine, 1 h", 3600e3, sine, 12000, 0.05, regular},
+    {"2 A / 0.2 A at 10 Hz, 10 min", 600e3, transient, 12000, 0.05, regular},
+    {"20 mA at 1 V, 1 h", 3600e3, small, 1000, 0, regular},
+    {"sine, jittered samples, 1 h", 3600e3, sine, 12000, 0.05, jittered},
+    {"sine, 1 s gaps, 1 h", 3600e3, sine, 12000, 0.05, gaps},
+  };
+
+  double voltageAt(const Waveform &waveform, double amperage) {
+    return waveform.sourceVoltage - amperage * waveform.sourceResistance;
+  }
+
+  // Midpoint rule on a step much finer than the waveform features
+  void integrate(const Waveform &waveform, double end, double &charge, double &energy) {
+    charge = 0;
+    energy = 0;
+    for (double time = EXACT_STEP / 2; time < end; time += EXACT_STEP) {
+      double amperage = waveform.amperage(time);
+      charge += amperage * EXACT_STEP;
+      energy += amperage * voltageAt(waveform, amperage) * EXACT_STEP;
+    }
+    charge /= MS_PER_HOUR;
+    energy /= MS_PER_HOUR * 1000;
+  }
+
+  // Firmware keeps the last sample, time has to go on from the previous run
+  uint32_t startTime = 0; // ms
+
+  bool check(const Waveform &waveform) {
+    // Same integer values the gauge would publish, trapezoid in double
+    double sampleCharge = 0;
+    double sampleEnergy = 0;
+    uint32_t time = 0;
+    uint32_t lastTime = 0;
+    uint16_t lastAmperage = 0;
+    uint32_t lastVoltage = 0;
+    for (uint32_t index = 0; time <= waveform.duration; time = waveform.nextTime(time, index++)) {
+      uint16_t amperage = lround(waveform.amperage(time));
+      uint32_t voltage = lround(voltageAt(waveform, amperage));
+      SystemState::setMeasurement(startTime + time, amperage, voltage);
+      if (index == 0) {
+        SystemState::resetAverageChargeAndEnergy();
+      } else {
+        sampleCharge += (lastAmperage + amperage) / 2.0 * (time - lastTime);
+        sampleEnergy += ((double) lastAmperage * lastVoltage + (double) amperage * voltage) / 2
+            * (time - lastTime);
+      }
+      lastTime = time;
+      lastAmperage = amperage;
+      lastVoltage = voltage;
+    }
+    startTime += lastTime + 1000;
+    sampleCharge /= MS_PER_HOUR;
+    sampleEnergy /= MS_PER_HOUR * 1000;
+
+    double exactCharge, exactEnergy;
+    integrate(waveform, lastTime, exactCharge, exactEnergy);
+    double charge = SystemState::getAverageCharge();
+    double energy = SystemState::getAverageEnergy();
+    double chargeError = charge / sampleCharge - 1;
+    double energyError = energy / sampleEnergy - 1;
+    printf("%-30s %10.3f mAh %+.1e %+.1e %11.3f mWh %+.1e %+.1e\n", waveform.name,
+        charge, chargeError, charge / exactCharge - 1, energy, energyError, energy / exactEnergy - 1);
+    return fabs(chargeError) <= TOLERANCE && fabs(energyError) <= TOLERANCE;
+  }
+};
+
+int main() {
+  printf("%-30s %14s %-17s %15s %s\n", "", "charge", "vs samples, exact", "energy", "vs samples, exact");
+  bool isPassed = true;
+  for (const Waveform &waveform : WAVEFORMS) {
+    isPassed &= check(waveform);
+  }
+  return isPassed ? 0 : 1;
+}
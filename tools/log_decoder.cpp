@@ -0,0 +1,340 @@
+// Converts binary logNNNN.bin and raw capture logNNNN.raw files written by
+// SdCardLogger into CSV or into columnar files (one raw little endian array
+// per field).
+//
+// Build: g++ -O2 -std=c++11 -o log_decoder tools/log_decoder.cpp
+// Usage: log_decoder log0001.bin > log0001.csv
+//        log_decoder log0001.raw > log0001.csv
+//        log_decoder --columns out_dir log0001.bin
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "../firmware/src/binary_log.h"
+
+namespace {
+  class MappedFile {
+    void *data = MAP_FAILED;
+    size_t size = 0;
+  public:
+    bool open(const char *path) {
+      int fd = ::open(path, O_RDONLY);
+      if (fd < 0) {
+        return false;
+      }
+      struct stat info;
+      if (fstat(fd, &info) == 0 && info.st_size > 0) {
+        size = info.st_size;
+        data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+          madvise(data, size, MADV_SEQUENTIAL);
+        }
+      }
+      close(fd);
+      return data != MAP_FAILED;
+    }
+
+    ~MappedFile() {
+      if (data != MAP_FAILED) {
+        munmap(data, size);
+      }
+    }
+
+    const uint8_t *begin() const {
+      return static_cast<const uint8_t *>(data);
+    }
+
+    size_t length() const {
+      return size;
+    }
+  };
+
+  // Buffered stdout writer, printf is too slow for multi-gigabyte logs
+  class CsvWriter {
+    static const size_t CAPACITY = 1 << 20;
+    FILE *file;
+    std::vector<char> buffer;
+    size_t used = 0;
+  public:
+    explicit CsvWriter(FILE *file) : file(file), buffer(CAPACITY) {}
+
+    ~CsvWriter() {
+      flush();
+    }
+
+    void flush() {
+      fwrite(buffer.data(), 1, used, file);
+      used = 0;
+    }
+
+    void reserve(size_t amount) {
+      if (used + amount > CAPACITY) {
+        flush();
+      }
+    }
+
+    void put(char chr) {
+      buffer[used++] = chr;
+    }
+
+    void put(const char *str) {
+      while (*str) {
+        put(*str++);
+      }
+    }
+
+    void putInt(int64_t value) {
+      if (value < 0) {
+        put('-');
+        value = -value;
+      }
+      char digits[20];
+      int count = 0;
+      do {
+        digits[count++] = '0' + value % 10;
+        value /= 10;
+      } while (value != 0);
+      while (count > 0) {
+        put(digits[--count]);
+      }
+    }
+
+    // Fixed point with the given number of decimals
+    void putFixed(int64_t value, int decimals) {
+      int64_t divider = 1;
+      for (int i = 0; i < decimals; ++i) {
+        divider *= 10;
+      }
+      if (value < 0) {
+        put('-');
+        value = -value;
+      }
+      putInt(value / divider);
+      put('.');
+      int64_t fraction = value % divider;
+      for (int64_t d = divider / 10; d > 0; d /= 10) {
+        put('0' + fraction / d % 10);
+      }
+    }
+  };
+
+  // Both record types start with timestamp
+  bool isErased(const uint8_t *record) {
+    uint32_t timestamp;
+    memcpy(&timestamp, record, sizeof(timestamp));
+    return timestamp == 0 || timestamp == 0xFFFFFFFF;
+  }
+
+  // Common part of Header and RawHeader
+  struct FileInfo {
+    uint16_t headerSize;
+    uint16_t recordSize;
+    uint16_t sampleRateHz;
+  };
+
+  void writeCsv(const FileInfo &info, const uint8_t *records, size_t count) {
+    CsvWriter out(stdout);
+    out.put("Time(ms),InstantAmperage(mA),AverageAmperage(mA),InstantVoltage(mV),AverageVoltage(mV),"
+            "Temperature(C),Charge(mAh),Energy(mWh),Emergency,Resistance(mOhm)\n");
+    // Older versions have shorter records, missing fields stay zero
+    size_t copySize = std::min<size_t>(info.recordSize, sizeof(BinaryLog::Record));
+    for (size_t i = 0; i < count; ++i) {
+      BinaryLog::Record record = {};
+      memcpy(&record, records + i * info.recordSize, copySize);
+      out.reserve(128);
+      out.putInt(record.timestamp);
+      out.put(',');
+      out.putInt(record.instantAmperage);
+      out.put(',');
+      out.putInt(record.averageAmperage);
+      out.put(',');
+      out.putInt(record.instantVoltage);
+      out.put(',');
+      out.putInt(record.averageVoltage);
+      out.put(',');
+      out.putFixed(record.averageTemperature, 1);
+      out.put(',');
+      out.putFixed((int64_t) (record.averageCharge * 1000.0 + 0.5), 3);
+      out.put(',');
+      out.putFixed((int64_t) (record.averageEnergy * 1000.0 + 0.5), 3);
+      out.put(',');
+      out.putInt(record.emergency);
+      out.put(',');
+      out.putFixed(record.internalResistance, 1);
+      out.put('\n');
+    }
+  }
+
+  void writeRawCsv(const FileInfo &info, const uint8_t *records, size_t count) {
+    CsvWriter out(stdout);
+    out.put("Time(ms),Amperage(mA),Voltage(mV)\n");
+    for (size_t i = 0; i < count; ++i) {
+      BinaryLog::RawRecord record;
+      memcpy(&record, records + i * info.recordSize, sizeof(record));
+      out.reserve(64);
+      out.putInt(record.timestamp);
+      out.put(',');
+      out.putInt(record.amperage);
+      out.put(',');
+      out.putInt(record.voltage);
+      out.put('\n');
+    }
+  }
+
+  struct Column {
+    const char *name;
+    const char *type;
+    size_t offset;
+    size_t size;
+  };
+
+  #define COLUMN(field, type) {#field, type, offsetof(BinaryLog::Record, field), sizeof(BinaryLog::Record::field)}
+  #define RAW_COLUMN(field, type) {#field, type, offsetof(BinaryLog::RawRecord, field), sizeof(BinaryLog::RawRecord::field)}
+
+  const Column RAW_COLUMNS[] = {
+    RAW_COLUMN(timestamp, "uint32"),
+    RAW_COLUMN(amperage, "uint16"),
+    RAW_COLUMN(voltage, "uint16"),
+  };
+
+  const Column COLUMNS[] = {
+    COLUMN(timestamp, "uint32"),
+    COLUMN(instantAmperage, "uint16"),
+    COLUMN(averageAmperage, "uint16"),
+    COLUMN(instantVoltage, "uint16"),
+    COLUMN(averageVoltage, "uint16"),
+    COLUMN(averageTemperature, "int16"),
+    COLUMN(averageCharge, "float32"),
+    COLUMN(averageEnergy, "float32"),
+    COLUMN(emergency, "uint16"),
+    COLUMN(internalResistance, "uint16"),
+  };
+
+  #undef COLUMN
+  #undef RAW_COLUMN
+
+  template<size_t N>
+  bool writeColumns(const char *directory, const Column (&columns)[N], const FileInfo &info,
+      const uint8_t *records, size_t count) {
+    std::string schemaPath = std::string(directory) + "/schema.txt";
+    FILE *schema = fopen(schemaPath.c_str(), "w");
+    if (!schema) {
+      return false;
+    }
+    fprintf(schema, "rows %zu\nsample_rate_hz %u\n", count, info.sampleRateHz);
+    std::vector<char> column;
+    for (const Column &field : columns) {
+      if (field.offset + field.size > info.recordSize) {
+        continue; // written by older version
+      }
+      fprintf(schema, "column %s %s\n", field.name, field.type);
+      column.resize(count * field.size);
+      for (size_t i = 0; i < count; ++i) {
+        memcpy(&column[i * field.size], records + i * info.recordSize + field.offset, field.size);
+      }
+      std::string path = std::string(directory) + "/" + field.name + ".bin";
+      FILE *file = fopen(path.c_str(), "wb");
+      if (!file || fwrite(column.data(), 1, column.size(), file) != column.size()) {
+        fclose(schema);
+        return false;
+      }
+      fclose(file);
+    }
+    fclose(schema);
+    return true;
+  }
+
+  // Records past the end of data are left erased by preallocation
+  size_t countRecords(const FileInfo &info, const uint8_t *records, size_t available) {
+    size_t low = 0;
+    size_t high = available;
+    while (low < high) {
+      size_t middle = (low + high) / 2;
+      if (isErased(records + middle * info.recordSize)) {
+        high = middle;
+      } else {
+        low = middle + 1;
+      }
+    }
+    return low;
+  }
+
+  int usage(const char *name) {
+    fprintf(stderr, "Usage: %s [--columns DIR] FILE\n", name);
+    return 2;
+  }
+}
+
+int main(int argc, char **argv) {
+  const char *columnsDirectory = nullptr;
+  const char *path = nullptr;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--columns") == 0 && i + 1 < argc) {
+      columnsDirectory = argv[++i];
+    } else if (!path) {
+      path = argv[i];
+    } else {
+      return usage(argv[0]);
+    }
+  }
+  if (!path) {
+    return usage(argv[0]);
+  }
+
+  MappedFile file;
+  if (!file.open(path)) {
+    fprintf(stderr, "Can not map %s: %s\n", path, strerror(errno));
+    return 1;
+  }
+
+  // Both headers start with magic, version, header and record sizes
+  BinaryLog::RawHeader header;
+  if (file.length() < sizeof(header)) {
+    fprintf(stderr, "File is too short\n");
+    return 1;
+  }
+  memcpy(&header, file.begin(), sizeof(header));
+  bool isRaw = header.magic == BinaryLog::RAW_MAGIC;
+  if ((!isRaw && header.magic != BinaryLog::MAGIC) || header.version == 0 || header.version > BinaryLog::VERSION) {
+    fprintf(stderr, "Unsupported file, magic %08x version %u\n", header.magic, header.version);
+    return 1;
+  }
+  size_t minimumRecordSize = isRaw ? sizeof(BinaryLog::RawRecord) : offsetof(BinaryLog::Record, internalResistance);
+  if (header.headerSize > file.length() || header.recordSize < minimumRecordSize) {
+    fprintf(stderr, "Corrupted header\n");
+    return 1;
+  }
+  if (isRaw && header.overrunRecords != 0) {
+    fprintf(stderr, "Warning: %u samples were lost during capture\n", header.overrunRecords);
+  }
+
+  FileInfo info = {header.headerSize, header.recordSize, header.sampleRateHz};
+  const uint8_t *records = file.begin() + info.headerSize;
+  size_t count = countRecords(info, records, (file.length() - info.headerSize) / info.recordSize);
+  bool isWritten = true;
+  if (columnsDirectory) {
+    isWritten = isRaw
+        ? writeColumns(columnsDirectory, RAW_COLUMNS, info, records, count)
+        : writeColumns(columnsDirectory, COLUMNS, info, records, count);
+  } else if (isRaw) {
+    writeRawCsv(info, records, count);
+  } else {
+    writeCsv(info, records, count);
+  }
+  if (!isWritten) {
+    fprintf(stderr, "Can not write columns to %s: %s\n", columnsDirectory, strerror(errno));
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,103 @@
+// Measures host cycles per StreamingStats::addMeasurement for the policy
+// combinations from firmware/src/average.h, with a window closed every 200
+// samples like the 200 Hz gauge and 1 s refresh. Numbers are relative, AVR
+// cost has to be read from the listing, but a policy which is much more
+// expensive here is expensive there too.
+//
+// Build: g++ -O2 -std=c++11 -o stats_bench tools/stats_bench.cpp
+// Usage: stats_bench [--samples 10000000]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../firmware/src/average.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace {
+  const uint16_t WINDOW = 200;
+
+  uint64_t readCycles() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+#endif
+  }
+
+  // Noisy ripple around a level, as from the gauge
+  template<typename ValueType>
+  void fillSamples(ValueType *samples, uint32_t count, ValueType level) {
+    uint32_t state = 1;
+    for (uint32_t i = 0; i < count; ++i) {
+      state = state * 1103515245 + 12345;
+      samples[i] = level + (state >> 16) % 64 + (i % 20 < 10 ? 50 : 0);
+    }
+  }
+
+  template<typename Stats, typename ValueType>
+  void run(const char *name, const ValueType *samples, uint32_t count) {
+    Stats stats;
+    uint32_t changes = 0;
+    uint64_t start = readCycles();
+    for (uint32_t i = 0; i < count; ++i) {
+      changes += stats.addMeasurement(samples[i]);
+      if (stats.counter == WINDOW) {
+        changes += stats.calculateAverageValue();
+      }
+    }
+    uint64_t cycles = readCycles() - start;
+    // Printing changes keeps the loop from being optimized out
+    printf("%-34s %6.2f cycles/sample %5zu bytes %u changes\n",
+        name, (double) cycles / count, sizeof(Stats), changes);
+  }
+
+  template<typename ValueType, typename AccumType>
+  void runAll(const char *type, const ValueType *samples, uint32_t count) {
+    using namespace Statistics;
+    char name[64];
+    snprintf(name, sizeof(name), "%s Mean", type);
+    run<StreamingStats<ValueType, AccumType, Mean>>(name, samples, count);
+    snprintf(name, sizeof(name), "%s MinMax", type);
+    run<StreamingStats<ValueType, AccumType, MinMax>>(name, samples, count);
+    snprintf(name, sizeof(name), "%s Ripple", type);
+    run<StreamingStats<ValueType, AccumType, Ripple>>(name, samples, count);
+    snprintf(name, sizeof(name), "%s Ema<4>", type);
+    run<StreamingStats<ValueType, AccumType, Ema<4>::Policy>>(name, samples, count);
+    snprintf(name, sizeof(name), "%s Mean MinMax", type);
+    run<StreamingStats<ValueType, AccumType, Mean, MinMax>>(name, samples, count);
+    snprintf(name, sizeof(name), "%s Mean MinMax Ripple", type);
+    run<StreamingStats<ValueType, AccumType, Mean, MinMax, Ripple>>(name, samples, count);
+  }
+};
+
+int main(int argc, char **argv) {
+  uint32_t count = 10000000;
+  for (int i = 1; i < argc; ++i) {
+    if (!strcmp(argv[i], "--samples") && i + 1 < argc) {
+      count = strtoul(argv[++i], NULL, 0);
+    } else {
+      fprintf(stderr, "Usage: %s [--samples 10000000]\n", argv[0]);
+      return 1;
+    }
+  }
+  if (count == 0) {
+    return 1;
+  }
+
+  uint16_t *amperage = new uint16_t[count];
+  uint32_t *voltage = new uint32_t[count];
+  fillSamples<uint16_t>(amperage, count, 1000);
+  fillSamples<uint32_t>(voltage, count, 3700);
+  runAll<uint16_t, uint32_t>("mA", amperage, count);
+  runAll<uint32_t, uint32_t>("mV", voltage, count);
+  delete[] amperage;
+  delete[] voltage;
+  return 0;
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+// Incremental decoder for telemetry frames from firmware/src/telemetry.cpp.
+// Feed it bytes as they arrive, complete packets are passed to the handler.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "../firmware/src/telemetry_protocol.h"
+
+class TelemetryDecoder {
+public:
+  struct Stats {
+    uint64_t packets = 0;
+    uint64_t lostPackets = 0; // sequence gaps
+    uint64_t corruptedFrames = 0; // bad COBS, CRC, type or size
+    uint64_t overlongFrames = 0;
+  };
+
+  class Handler {
+  public:
+    virtual ~Handler() {}
+    virtual void onSample(const TelemetryProtocol::SamplePayload &sample) = 0;
+    virtual void onState(const TelemetryProtocol::StatePayload &state) = 0;
+  };
+
+  explicit TelemetryDecoder(Handler &handler) : handler(handler) {}
+
+  void feed(const uint8_t *data, size_t length) {
+    for (size_t i = 0; i < length; ++i) {
+      feed(data[i]);
+    }
+  }
+
+  void feed(uint8_t byte) {
+    if (byte != 0) {
+      if (frameLength < sizeof(frame)) {
+        frame[frameLength] = byte;
+      }
+      ++frameLength;
+      return;
+    }
+    if (frameLength > sizeof(frame)) {
+      ++stats.overlongFrames;
+    } else if (frameLength != 0) {
+      decodeFrame();
+    }
+    frameLength = 0;
+  }
+
+  const Stats &getStats() const {
+    return stats;
+  }
+
+private:
+  Handler &handler;
+  Stats stats;
+  uint8_t frame[TelemetryProtocol::MAX_FRAME_SIZE];
+  size_t frameLength = 0;
+  bool hasSequence = false;
+  uint8_t expectedSequence = 0;
+
+  void decodeFrame() {
+    uint8_t packet[TelemetryProtocol::MAX_FRAME_SIZE];
+    size_t length = 0;
+    size_t index = 0;
+    while (index < frameLength) {
+      uint8_t code = frame[index++];
+      if (index + code - 1 > frameLength) {
+        ++stats.corruptedFrames;
+        return;
+      }
+      for (uint8_t i = 1; i < code; ++i) {
+        packet[length++] = frame[index++];
+      }
+      if (code != 0xFF && index < frameLength) {
+        packet[length++] = 0;
+      }
+    }
+
+    TelemetryProtocol::Header header;
+    if (length < sizeof(header) + sizeof(uint16_t)) {
+      ++stats.corruptedFrames;
+      return;
+    }
+    length -= sizeof(uint16_t);
+    uint16_t crc = 0xFFFF;
+    for (size_t i = 0; i < length; ++i) {
+      crc = TelemetryProtocol::crcUpdate(crc, packet[i]);
+    }
+    if (crc != (packet[length] | packet[length + 1] << 8)) {
+      ++stats.corruptedFrames;
+      return;
+    }
+
+    memcpy(&header, packet, sizeof(header));
+    const uint8_t *payload = packet + sizeof(header);
+    size_t payloadLength = length - sizeof(header);
+    if (header.type == TelemetryProtocol::Sample && payloadLength == sizeof(TelemetryProtocol::SamplePayload)) {
+      TelemetryProtocol::SamplePayload sample;
+      memcpy(&sample, payload, sizeof(sample));
+      countPacket(header.sequence);
+      handler.onSample(sample);
+    } else if (header.type == TelemetryProtocol::State && payloadLength == sizeof(TelemetryProtocol::StatePayload)) {
+      TelemetryProtocol::StatePayload state;
+      memcpy(&state, payload, sizeof(state));
+      countPacket(header.sequence);
+      handler.onState(state);
+    } else {
+      ++stats.corruptedFrames;
+    }
+  }
+
+  void countPacket(uint8_t sequence) {
+    if (hasSequence) {
+      stats.lostPackets += (uint8_t) (sequence - expectedSequence);
+    }
+    hasSequence = true;
+    expectedSequence = sequence + 1;
+    ++stats.packets;
+  }
+};
@@ -0,0 +1,144 @@
+// Receives binary telemetry stream (firmware TELEMETRY_ENABLED) from serial
+// port and prints samples and states as CSV lines. Packet statistics go to
+// stderr every few seconds and on exit. Any readable file works as input,
+// e.g. a pty or a recorded stream.
+//
+// Build: g++ -O2 -std=c++11 -o telemetry_receiver tools/telemetry_receiver.cpp
+// Usage: telemetry_receiver [--baud 500000] /dev/ttyUSB0 > telemetry.csv
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "telemetry_decoder.h"
+
+namespace {
+  volatile sig_atomic_t isStopped = 0;
+
+  void stop(int) {
+    isStopped = 1;
+  }
+
+  class CsvHandler : public TelemetryDecoder::Handler {
+  public:
+    void onSample(const TelemetryProtocol::SamplePayload &sample) override {
+      printf("sample,%u,%u,%u\n", sample.timestamp, sample.amperage, sample.voltage);
+    }
+
+    void onState(const TelemetryProtocol::StatePayload &state) override {
+      const BinaryLog::Record &record = state.record;
+      printf("state,%u,%u,%u,%u,%u,%.1f,%.3f,%.3f,%u,%.1f,%u,%u,%u,%u,%u,%u,%u\n",
+          record.timestamp, record.instantAmperage, record.averageAmperage,
+          record.instantVoltage, record.averageVoltage, record.averageTemperature / 10.0,
+          record.averageCharge, record.averageEnergy, record.emergency, record.internalResistance / 10.0,
+          state.desiredAmperage, state.stopVoltage, state.loadMode, state.loadSetpoint,
+          state.targetAmperage, state.changeFlags, state.droppedPackets);
+    }
+  };
+
+  speed_t toSpeed(long baud) {
+    switch (baud) {
+      case 9600: return B9600;
+      case 115200: return B115200;
+      case 230400: return B230400;
+#ifdef B500000
+      case 500000: return B500000;
+      case 1000000: return B1000000;
+#endif
+      default: return 0;
+    }
+  }
+
+  bool configurePort(int fd, long baud) {
+    if (!isatty(fd)) {
+      return true;
+    }
+    speed_t speed = toSpeed(baud);
+    struct termios options;
+    if (speed == 0 || tcgetattr(fd, &options) != 0) {
+      return false;
+    }
+    cfmakeraw(&options);
+    cfsetispeed(&options, speed);
+    cfsetospeed(&options, speed);
+    options.c_cc[VMIN] = 1;
+    options.c_cc[VTIME] = 0;
+    return tcsetattr(fd, TCSANOW, &options) == 0;
+  }
+
+  void printStats(const TelemetryDecoder::Stats &stats) {
+    uint64_t expected = stats.packets + stats.lostPackets;
+    fprintf(stderr, "packets %llu lost %llu (%.3f%%) corrupted %llu overlong %llu\n",
+        (unsigned long long) stats.packets, (unsigned long long) stats.lostPackets,
+        expected ? 100.0 * stats.lostPackets / expected : 0.0,
+        (unsigned long long) stats.corruptedFrames, (unsigned long long) stats.overlongFrames);
+  }
+
+  int usage(const char *name) {
+    fprintf(stderr, "Usage: %s [--baud RATE] DEVICE\n", name);
+    return 2;
+  }
+}
+
+int main(int argc, char **argv) {
+  long baud = 500000;
+  const char *path = nullptr;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--baud") == 0 && i + 1 < argc) {
+      baud = atol(argv[++i]);
+    } else if (!path) {
+      path = argv[i];
+    } else {
+      return usage(argv[0]);
+    }
+  }
+  if (!path) {
+    return usage(argv[0]);
+  }
+
+  int fd = open(path, O_RDONLY | O_NOCTTY);
+  if (fd < 0) {
+    fprintf(stderr, "Can not open %s: %s\n", path, strerror(errno));
+    return 1;
+  }
+  if (!configurePort(fd, baud)) {
+    fprintf(stderr, "Can not configure %s for %ld baud\n", path, baud);
+    return 1;
+  }
+
+  struct sigaction action = {};
+  action.sa_handler = stop;
+  sigaction(SIGINT, &action, nullptr);
+  sigaction(SIGTERM, &action, nullptr);
+
+  CsvHandler handler;
+  TelemetryDecoder decoder(handler);
+  time_t lastStatsTime = time(nullptr);
+  uint8_t buffer[4096];
+  while (!isStopped) {
+    ssize_t length = read(fd, buffer, sizeof(buffer));
+    if (length < 0 && errno == EINTR) {
+      continue;
+    }
+    if (length <= 0) {
+      break;
+    }
+    decoder.feed(buffer, length);
+    time_t now = time(nullptr);
+    if (now - lastStatsTime >= 5) {
+      lastStatsTime = now;
+      fflush(stdout);
+      printStats(decoder.getStats());
+    }
+  }
+  close(fd);
+  fflush(stdout);
+  printStats(decoder.getStats());
+  return 0;
+}
@@ -0,0 +1,109 @@
+// Compares ThermistorTable (firmware/src/thermistor_table.h) with the float
+// beta equation FanTemperatureReader used before, over all 1024 ADC codes,
+// and measures host cycles per conversion for both. Fails if the table is
+// off by more than 1 *C anywhere between -20 and 150 *C. ADC code 0 is
+// skipped, the float math reads it as -99.9 *C and the table as the hottest.
+// The host has an FPU, so the float cost here is far below the AVR one.
+//
+// Build: g++ -O2 -std=c++11 -o thermistor_check tools/thermistor_check.cpp
+// Usage: thermistor_check [--verbose]
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define PROGMEM
+#define pgm_read_word_near(address) (*(const int16_t *) (address))
+
+#include "../firmware/src/thermistor_table.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace {
+  const int16_t CHECKED_LOW = -200; // 0.1 *C
+  const int16_t CHECKED_HIGH = 1500;
+  const int16_t TOLERANCE = 10;
+  const uint32_t BENCH_ROUNDS = 2000;
+
+  uint64_t readCycles() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000ULL + now.tv_nsec;
+#endif
+  }
+
+  // Float math removed from FanTemperatureReader, adc is the averaged reading
+  int16_t referenceTemperature(float adc) {
+    float temperature = 1023 / adc - 1;
+    temperature = THERMISTOR_SERIES_RESISTOR / temperature;
+    temperature = temperature / THERMISTOR_NOMINAL;
+    temperature = logf(temperature);
+    temperature /= B_COEFFICIENT;
+    temperature += 1.0 / (TEMPERATURE_NOMINAL + 273.15);
+    temperature = 1.0 / temperature;
+    temperature -= 273.15;
+    float deciDegree = roundf(temperature * 10);
+    return deciDegree < -999 ? -999 : deciDegree > 2000 ? 2000 : deciDegree;
+  }
+
+  // Summing the results keeps the loops from being optimized out
+  template<typename Convert>
+  double measure(Convert convert, int32_t &sum) {
+    uint64_t start = readCycles();
+    for (uint32_t round = 0; round < BENCH_ROUNDS; ++round) {
+      for (uint16_t adc = 1; adc < 1023; ++adc) {
+        sum += convert(adc);
+      }
+    }
+    return (double) (readCycles() - start) / (BENCH_ROUNDS * 1022);
+  }
+};
+
+int main(int argc, char **argv) {
+  bool isVerbose = argc > 1 && !strcmp(argv[1], "--verbose");
+
+  int16_t maxError = 0;
+  int16_t maxCheckedError = 0;
+  uint16_t maxCheckedAdc = 0;
+  uint16_t failures = 0;
+  for (uint16_t adc = 1; adc < 1024; ++adc) {
+    int16_t expected = referenceTemperature(adc);
+    int16_t actual = ThermistorTable::toTemperature(adc << ThermistorTable::ADC_FRACTION_BITS);
+    int16_t error = abs(actual - expected);
+    maxError = error > maxError ? error : maxError;
+    bool isChecked = expected >= CHECKED_LOW && expected <= CHECKED_HIGH;
+    if (isChecked && error > maxCheckedError) {
+      maxCheckedError = error;
+      maxCheckedAdc = adc;
+    }
+    if (isChecked && error > TOLERANCE) {
+      ++failures;
+    }
+    if (isVerbose) {
+      printf("%4u %6.1f %6.1f\n", adc, expected / 10.0, actual / 10.0);
+    }
+  }
+  printf("largest error %.1f *C between %.0f and %.0f *C (adc %u), %.1f *C overall\n",
+      maxCheckedError / 10.0, CHECKED_LOW / 10.0, CHECKED_HIGH / 10.0, maxCheckedAdc, maxError / 10.0);
+
+  int32_t sum = 0;
+  double tableCycles = measure([](uint16_t adc) {
+    return ThermistorTable::toTemperature(adc << ThermistorTable::ADC_FRACTION_BITS);
+  }, sum);
+  double floatCycles = measure([](uint16_t adc) { return referenceTemperature(adc); }, sum);
+  printf("table %.2f cycles, float %.2f cycles per conversion (%d)\n", tableCycles, floatCycles, sum);
+
+  if (failures != 0) {
+    printf("%u codes off by more than %.1f *C\n", failures, TOLERANCE / 10.0);
+    return 1;
+  }
+  return 0;
+}